@@ -1,5 +1,6 @@
 /* affine cipher -- encrypt and decrypt strings with a simple formula */
 
+#include <errno.h>
 #include <error.h>
 #include <getopt.h>
 #include <inttypes.h>
@@ -8,8 +9,15 @@
 #include <stdlib.h>
 #include <string.h>
 
-/* Standard 26-character alphabet */
-#define ALPHABET_SIZE 26
+#include "../common/cipher.h"
+#include "../common/cpu.h"
+#include "../common/crack.h"
+#include "../common/fanout.h"
+#include "../common/histogram.h"
+#include "../common/inplace.h"
+#include "../common/parallel.h"
+#include "../common/stream.h"
+#include "../common/table.h"
 
 /* Affine cipher mode */
 enum cipher_mode {
@@ -17,9 +25,17 @@ enum cipher_mode {
 };
 
 static struct option const long_opts[] = {
+	{"crack", no_argument, NULL, 'c'},
 	{"decrypt", no_argument, NULL, 'd'},
 	{"encrypt", no_argument, NULL, 'e'},
+	{"files", no_argument, NULL, 'f'},
 	{"help", no_argument, NULL, 'h'},
+	{"in-place", no_argument, NULL, 'i'},
+	{"isa", required_argument, NULL, 'I'},
+	{"keys", required_argument, NULL, 'K'},
+	{"output", required_argument, NULL, 'o'},
+	{"top", required_argument, NULL, 'k'},
+	{"threads", required_argument, NULL, 't'},
 
 	{NULL, 0, NULL, 0}
 };
@@ -27,15 +43,43 @@ static struct option const long_opts[] = {
 static _Noreturn void usage(int const status, char const *const name)
 {
 	printf("Usage: %s [OPTION]... A B [STRING]...\n", name);
+	printf("  or:  %s [OPTION]... -f A B [FILE]...\n", name);
+	printf("  or:  %s [OPTION]... -i A B FILE...\n", name);
+	printf("  or:  %s [OPTION]... -c [-f|-i] [STRING/FILE]...\n", name);
+	printf("  or:  %s [OPTION]... -K LIST -o DEST [FILE]...\n", name);
 	if(status != EXIT_SUCCESS) {
 		fprintf(stderr, "Try '%s --help' for more information.\n", name);
 	} else {
 		puts("Encrypt and decrypt strings with a simple formula.");
 		printf("Example: %s -e 5 7 \"Hello World!\"\n", name);
 		puts("\nOptions:\n\
+  -c, --crack      find A and B by letter frequency analysis,\n\
+                   print the best keys to standard error and\n\
+                   decrypt with the best one; A and B are\n\
+                   not given\n\
   -d, --decrypt    decrypt input strings\n\
   -e, --encrypt    encrypt input strings\n\
-  -h, --help       display this help text and exit");
+  -f, --files      read input from FILEs instead of STRINGs;\n\
+                   with no FILE, or when FILE is -, read\n\
+                   standard input\n\
+  -h, --help       display this help text and exit\n\
+  -i, --in-place   transform FILEs in place instead of\n\
+                   printing them\n\
+  -I, --isa=TIER   force the scalar, sse2, avx2 or avx512\n\
+                   kernels (default: widest supported,\n\
+                   or $CIPHER_ISA)\n\
+  -k, --top=N      with '--crack', print the N best keys;\n\
+                   0 prints all of them (default: 5)\n\
+  -K, --keys=LIST  transform FILEs with every A:B pair of the\n\
+                   comma-separated LIST, reading them once;\n\
+                   A and B are not given\n\
+  -o, --output=DEST\n\
+                   with '--keys', write each pair's result to\n\
+                   DEST with {} replaced by A:B, or to the\n\
+                   matching entry of a comma-separated DEST;\n\
+                   &N is descriptor N\n\
+  -t, --threads=N  transform FILEs on N threads;\n\
+                   0 uses one per processor");
 		printf("\nA must be coprime of %d, default mode is encryption.\n",
 			   ALPHABET_SIZE);
 	}
@@ -43,103 +87,471 @@ static _Noreturn void usage(int const status, char const *const name)
 	exit(status);
 }
 
-__attribute__((const))
-static inline intmax_t gcd(intmax_t const a, intmax_t const b)
+/* Compiled cipher, shared by the table and vector kernels.
+	Both modes reduce to (mul * x + add) % ALPHABET_SIZE on letter offsets */
+struct affine_key {
+	table_t table;
+	char mul;
+	char add;
+};
+
+/* Compile the cipher once, encrypt_char and decrypt_char stay the reference */
+static void affine_key(struct affine_key *const key, intmax_t const a,
+					   intmax_t const b, enum cipher_mode const cipher_mode,
+					   intmax_t const mod_inv)
+{
+	if(cipher_mode == encrypt)
+		affine_encrypt_table(key->table, a, b);
+	else
+		affine_decrypt_table(key->table, b, mod_inv);
+
+	if(cipher_mode == encrypt) {
+		key->mul = (char)(a % ALPHABET_SIZE);
+		key->add = (char)(b % ALPHABET_SIZE);
+	} else {
+		/* mod_inv * (x - b) == mod_inv * x + mod_inv * (ALPHABET_SIZE - b) */
+		key->mul = (char)mod_inv;
+		key->add = (char)(mod_inv * (ALPHABET_SIZE - b % ALPHABET_SIZE)
+						  % ALPHABET_SIZE);
+	}
+}
+
+static void affine_block_scalar(char *const buf, size_t const len,
+								void const *const arg)
+{
+	struct affine_key const *const key = arg;
+	table_apply(key->table, buf, len);
+}
+
+#ifdef CPU_X86
+/* ceil(2^16 / ALPHABET_SIZE), floor(v * M / 2^16) == v / ALPHABET_SIZE
+	for every v up to (ALPHABET_SIZE - 1) * ALPHABET_SIZE */
+#define MOD_MAGIC 2521
+
+/* (mul * v + add) % ALPHABET_SIZE in 16-bit lanes, v < ALPHABET_SIZE */
+__attribute__((target("sse2")))
+static inline __m128i affine_lanes_sse2(__m128i const v, __m128i const mul,
+										__m128i const add)
 {
-	return (b != 0) ? gcd(b, a % b) : a;
+	__m128i const t = _mm_add_epi16(_mm_mullo_epi16(v, mul), add);
+	__m128i const q = _mm_mulhi_epu16(t, _mm_set1_epi16(MOD_MAGIC));
+	return _mm_sub_epi16(t, _mm_mullo_epi16(q, _mm_set1_epi16(ALPHABET_SIZE)));
 }
 
-/* Calculate modular multiplicitive inverse,
-	source: Rosetta Code */
-__attribute__((const))
-static intmax_t mod_inverse(intmax_t a, intmax_t b)
+/* Encrypt letters in 16 bytes, other bytes pass through; case is kept by
+	clearing bit 0x20 of the lowercase result wherever the input had it clear */
+__attribute__((target("sse2")))
+static inline __m128i affine_vector_sse2(__m128i const x, __m128i const mul,
+										 __m128i const add)
 {
-	if(b == 1)
-		return 1;
+	__m128i const d = _mm_sub_epi8(_mm_or_si128(x, _mm_set1_epi8(0x20)),
+								   _mm_set1_epi8('a'));
+	__m128i const letter = _mm_cmpeq_epi8(
+		_mm_min_epu8(d, _mm_set1_epi8(ALPHABET_SIZE - 1)), d);
+
+	__m128i const low = _mm_set1_epi16(0x00ff);
+	__m128i const even = affine_lanes_sse2(_mm_and_si128(d, low), mul, add);
+	__m128i const odd = affine_lanes_sse2(_mm_srli_epi16(d, 8), mul, add);
+	__m128i const r = _mm_or_si128(even, _mm_slli_epi16(odd, 8));
+
+	__m128i const enc = _mm_and_si128(_mm_add_epi8(r, _mm_set1_epi8('a')),
+		_mm_or_si128(x, _mm_set1_epi8((char)~0x20)));
 
-	intmax_t const b0 = b;
-	intmax_t t, q;
-	intmax_t x0 = 0, x1 = 1;
+	return _mm_or_si128(_mm_and_si128(letter, enc),
+						_mm_andnot_si128(letter, x));
+}
 
-	while(a > 1) {
-		q = a / b;
-		t = b;
-		b = a % b;
-		a = t;
-		t = x0;
-		x0 = x1 - q * x0;
-		x1 = t;
+__attribute__((target("sse2")))
+static void affine_block_sse2(char *const buf, size_t const len,
+							  void const *const arg)
+{
+	struct affine_key const *const key = arg;
+	__m128i const mul = _mm_set1_epi16(key->mul);
+	__m128i const add = _mm_set1_epi16(key->add);
+	size_t i = 0;
+
+	for(; i + 16 <= len; i += 16) {
+		__m128i const x = _mm_loadu_si128((__m128i const *)(buf + i));
+		_mm_storeu_si128((__m128i *)(buf + i),
+						 affine_vector_sse2(x, mul, add));
 	}
 
-	if(x1 < 0)
-		x1 += b0;
-	
-	return x1;
+	table_apply(key->table, buf + i, len - i);
 }
 
-/* Assumes contiguous character encoding from a-z A-Z */
-static char encrypt_char(char const ch, intmax_t const a, intmax_t const b)
+/* Same as affine_lanes_sse2, 32 bytes at a time */
+__attribute__((target("avx2")))
+static inline __m256i affine_lanes_avx2(__m256i const v, __m256i const mul,
+										__m256i const add)
 {
-	intmax_t enc;
+	__m256i const t = _mm256_add_epi16(_mm256_mullo_epi16(v, mul), add);
+	__m256i const q = _mm256_mulhi_epu16(t, _mm256_set1_epi16(MOD_MAGIC));
+	return _mm256_sub_epi16(t,
+		_mm256_mullo_epi16(q, _mm256_set1_epi16(ALPHABET_SIZE)));
+}
 
-	if(ch >= 'a' && ch <= 'z')
-		enc = 'a';
-	else if(ch >= 'A' && ch <= 'Z')
-		enc = 'A';
-	else
-		return ch;
+__attribute__((target("avx2")))
+static inline __m256i affine_vector_avx2(__m256i const x, __m256i const mul,
+										 __m256i const add)
+{
+	__m256i const d = _mm256_sub_epi8(
+		_mm256_or_si256(x, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+	__m256i const letter = _mm256_cmpeq_epi8(
+		_mm256_min_epu8(d, _mm256_set1_epi8(ALPHABET_SIZE - 1)), d);
+
+	__m256i const low = _mm256_set1_epi16(0x00ff);
+	__m256i const even = affine_lanes_avx2(_mm256_and_si256(d, low),
+										   mul, add);
+	__m256i const odd = affine_lanes_avx2(_mm256_srli_epi16(d, 8), mul, add);
+	__m256i const r = _mm256_or_si256(even, _mm256_slli_epi16(odd, 8));
+
+	__m256i const enc = _mm256_and_si256(
+		_mm256_add_epi8(r, _mm256_set1_epi8('a')),
+		_mm256_or_si256(x, _mm256_set1_epi8((char)~0x20)));
+
+	return _mm256_blendv_epi8(x, enc, letter);
+}
+
+__attribute__((target("avx2")))
+static void affine_block_avx2(char *const buf, size_t const len,
+							  void const *const arg)
+{
+	struct affine_key const *const key = arg;
+	__m256i const mul = _mm256_set1_epi16(key->mul);
+	__m256i const add = _mm256_set1_epi16(key->add);
+	size_t i = 0;
+
+	for(; i + 32 <= len; i += 32) {
+		__m256i const x = _mm256_loadu_si256((__m256i const *)(buf + i));
+		_mm256_storeu_si256((__m256i *)(buf + i),
+							affine_vector_avx2(x, mul, add));
+	}
+
+	table_apply(key->table, buf + i, len - i);
+}
 
-	return (char)(enc + ((a * ((intmax_t)ch - enc) + b) % ALPHABET_SIZE));
+/* Same as affine_lanes_sse2, 64 bytes at a time */
+__attribute__((target("avx512f,avx512bw")))
+static inline __m512i affine_lanes_avx512(__m512i const v, __m512i const mul,
+										  __m512i const add)
+{
+	__m512i const t = _mm512_add_epi16(_mm512_mullo_epi16(v, mul), add);
+	__m512i const q = _mm512_mulhi_epu16(t, _mm512_set1_epi16(MOD_MAGIC));
+	return _mm512_sub_epi16(t,
+		_mm512_mullo_epi16(q, _mm512_set1_epi16(ALPHABET_SIZE)));
 }
 
-static char decrypt_char(char const ch, intmax_t const b,
-						 intmax_t const mod_inv)
+__attribute__((target("avx512f,avx512bw")))
+static inline __m512i affine_vector_avx512(__m512i const x, __m512i const mul,
+										   __m512i const add)
 {
-	intmax_t dec;
+	__m512i const d = _mm512_sub_epi8(
+		_mm512_or_si512(x, _mm512_set1_epi8(0x20)), _mm512_set1_epi8('a'));
+	__mmask64 const letter = _mm512_cmplt_epu8_mask(d,
+		_mm512_set1_epi8(ALPHABET_SIZE));
+
+	__m512i const low = _mm512_set1_epi16(0x00ff);
+	__m512i const even = affine_lanes_avx512(_mm512_and_si512(d, low),
+											 mul, add);
+	__m512i const odd = affine_lanes_avx512(_mm512_srli_epi16(d, 8),
+											mul, add);
+	__m512i const r = _mm512_or_si512(even, _mm512_slli_epi16(odd, 8));
+
+	__m512i const enc = _mm512_and_si512(
+		_mm512_add_epi8(r, _mm512_set1_epi8('a')),
+		_mm512_or_si512(x, _mm512_set1_epi8((char)~0x20)));
+
+	return _mm512_mask_blend_epi8(letter, x, enc);
+}
 
-	if(ch >= 'a' && ch <= 'z')
-		dec = 'a';
-	else if(ch >= 'A' && ch <= 'Z')
-		dec = 'A';
-	else
-		return ch;
+__attribute__((target("avx512f,avx512bw")))
+static void affine_block_avx512(char *const buf, size_t const len,
+								void const *const arg)
+{
+	struct affine_key const *const key = arg;
+	__m512i const mul = _mm512_set1_epi16(key->mul);
+	__m512i const add = _mm512_set1_epi16(key->add);
+	size_t i = 0;
+
+	for(; i + 64 <= len; i += 64) {
+		__m512i const x = _mm512_loadu_si512(buf + i);
+		_mm512_storeu_si512(buf + i, affine_vector_avx512(x, mul, add));
+	}
+
+	table_apply(key->table, buf + i, len - i);
+}
+#endif
+
+/* Kernel for the selected tier, affine_block_scalar is the reference */
+static stream_fn *affine_kernel(void)
+{
+	switch(cpu_tier()) {
+#ifdef CPU_X86
+		case tier_avx512:
+			return affine_block_avx512;
+		case tier_avx2:
+			return affine_block_avx2;
+		case tier_sse2:
+			return affine_block_sse2;
+#endif
+		default:
+			return affine_block_scalar;
+	}
+}
+
+/* One entry of a '--keys' list */
+struct affine_pair {
+	intmax_t a;
+	intmax_t b;
+};
+
+/* Parse the comma-separated "A:B" entries of LIST, returns the number of
+	pairs stored in the allocated *PAIRS */
+static size_t affine_keys(char const *const list,
+						  struct affine_pair **const pairs)
+{
+	size_t count = 0;
+	size_t cap = 0;
+	char const *p = list;
+
+	*pairs = NULL;
+
+	for(;;) {
+		char *end;
+		intmax_t const a = strtoimax(p, &end, 10);
+
+		if(end == p || *end != ':')
+			error(EXIT_FAILURE, 0, "invalid key list '%s'", list);
+
+		p = end + 1;
+
+		intmax_t const b = strtoimax(p, &end, 10);
+
+		if(end == p || a < 0 || b < 0)
+			error(EXIT_FAILURE, 0, "invalid key list '%s'", list);
+
+		if(gcd(a, ALPHABET_SIZE) != 1) {
+			error(EXIT_FAILURE, 0, "A must be coprime to %d, got %jd",
+				  ALPHABET_SIZE, a);
+		}
+
+		if(count == cap) {
+			cap = cap ? cap * 2 : 32;
+
+			if((*pairs = realloc(*pairs, cap * sizeof(**pairs))) == NULL)
+				error(EXIT_FAILURE, errno, "error allocating keys");
+		}
+
+		(*pairs)[count++] = (struct affine_pair) {a, b};
+
+		if(*end == '\0')
+			return count;
+
+		if(*end != ',')
+			error(EXIT_FAILURE, 0, "invalid key list '%s'", list);
+
+		p = end + 1;
+	}
+}
+
+/* Every A coprime to ALPHABET_SIZE, paired with every B */
+#define AFFINE_KEYS (12 * ALPHABET_SIZE)
+
+/* ALPHABET_SIZE rounded up to the widest vector of doubles */
+#define SCORE_LANES 32
+
+/* Sum of X[i] * Y[i] over SCORE_LANES doubles */
+typedef double dot_fn(double const *x, double const *y);
+
+static double dot_scalar(double const *const x, double const *const y)
+{
+	double sum = 0;
+
+	for(size_t i = 0; i < SCORE_LANES; ++i)
+		sum += x[i] * y[i];
+
+	return sum;
+}
+
+#ifdef CPU_X86
+__attribute__((target("sse2")))
+static double dot_sse2(double const *const x, double const *const y)
+{
+	__m128d sum = _mm_setzero_pd();
+
+	for(size_t i = 0; i < SCORE_LANES; i += 2)
+		sum = _mm_add_pd(sum, _mm_mul_pd(_mm_loadu_pd(x + i),
+										 _mm_loadu_pd(y + i)));
+
+	return _mm_cvtsd_f64(_mm_add_sd(sum, _mm_unpackhi_pd(sum, sum)));
+}
+
+__attribute__((target("avx2,fma")))
+static double dot_avx2(double const *const x, double const *const y)
+{
+	__m256d sum = _mm256_setzero_pd();
+
+	for(size_t i = 0; i < SCORE_LANES; i += 4)
+		sum = _mm256_fmadd_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i),
+							  sum);
+
+	__m128d const half = _mm_add_pd(_mm256_castpd256_pd128(sum),
+									_mm256_extractf128_pd(sum, 1));
+
+	return _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+}
 
-	return (char)(dec + (mod_inv * (ALPHABET_SIZE + ch - dec - b)
-			% ALPHABET_SIZE));
+__attribute__((target("avx512f")))
+static double dot_avx512(double const *const x, double const *const y)
+{
+	__m512d sum = _mm512_setzero_pd();
+
+	for(size_t i = 0; i < SCORE_LANES; i += 8)
+		sum = _mm512_fmadd_pd(_mm512_loadu_pd(x + i), _mm512_loadu_pd(y + i),
+							  sum);
+
+	return _mm512_reduce_add_pd(sum);
+}
+#endif
+
+static dot_fn *dot_kernel(void)
+{
+	switch(cpu_tier()) {
+#ifdef CPU_X86
+		case tier_avx512:
+			return dot_avx512;
+		case tier_avx2:
+			if(__builtin_cpu_supports("fma"))
+				return dot_avx2;
+			return dot_sse2;
+		case tier_sse2:
+			return dot_sse2;
+#endif
+		default:
+			return dot_scalar;
+	}
 }
 
-static void affine_cipher(char const *const string, intmax_t const a,
-						  intmax_t const b, enum cipher_mode const cipher_mode,
-						  intmax_t const mod_inv)
+/* Rank all AFFINE_KEYS keys, key A * ALPHABET_SIZE + B, from the letter
+	histogram alone. Plaintext letter j is counted at (A * j + B) % 26,
+	which is Q[(j + B / A) % 26] for Q[k] = count[A * k % 26]. Expanding
+	chi-squared leaves sum(Q[j + s]^2 / E[j]) - total, so each A needs
+	one table of squares and each B one dot product with 1 / E */
+static void affine_crack(struct crack_rank *const ranks,
+						 struct histogram const *const h)
 {
-	for(size_t i = 0; string[i]; ++i) {
-		if(cipher_mode == encrypt)
-			putchar(encrypt_char(string[i], a, b));
-		else
-			putchar(decrypt_char(string[i], b, mod_inv));
+	uint64_t letters[HISTOGRAM_LETTERS];
+	uint64_t total = 0;
+	double inverse[SCORE_LANES] = {0};
+	double square[ALPHABET_SIZE + SCORE_LANES] = {0};
+	dot_fn *const dot = dot_kernel();
+	size_t n = 0;
+
+	histogram_letters(h, letters);
+
+	for(size_t j = 0; j < ALPHABET_SIZE; ++j) {
+		total += letters[j];
+		inverse[j] = 1 / english_freq[j];
+	}
+
+	for(intmax_t a = 1; a < ALPHABET_SIZE; ++a) {
+		if(gcd(a, ALPHABET_SIZE) != 1)
+			continue;
+
+		intmax_t const inv = mod_inverse(a, ALPHABET_SIZE);
+
+		for(size_t k = 0; k < 2 * ALPHABET_SIZE; ++k) {
+			double const q = (double)letters[(size_t)a * k % ALPHABET_SIZE];
+			square[k] = q * q;
+		}
+
+		for(intmax_t b = 0; b < ALPHABET_SIZE; ++b) {
+			size_t const s = (size_t)(b * inv % ALPHABET_SIZE);
+			double const sum = total ? dot(square + s, inverse) : 0;
+
+			ranks[n].key = (uintmax_t)(a * ALPHABET_SIZE + b);
+			ranks[n].score = total ? sum / (double)total - (double)total : 0;
+			++n;
+		}
 	}
+
+	crack_sort(ranks, n);
+}
+
+/* Print the TOP best keys to standard error and compile the best one
+	for decryption */
+static void affine_crack_key(struct affine_key *const key,
+							 struct histogram const *const h,
+							 size_t const top)
+{
+	struct crack_rank ranks[AFFINE_KEYS];
+
+	affine_crack(ranks, h);
+
+	for(size_t i = 0; i < AFFINE_KEYS && (top == 0 || i < top); ++i) {
+		fprintf(stderr, "A=%ju B=%ju: chi-squared %.2f\n",
+				ranks[i].key / ALPHABET_SIZE, ranks[i].key % ALPHABET_SIZE,
+				ranks[i].score);
+	}
+
+	intmax_t const a = (intmax_t)(ranks[0].key / ALPHABET_SIZE);
+	intmax_t const b = (intmax_t)(ranks[0].key % ALPHABET_SIZE);
+
+	affine_key(key, a, b, decrypt, mod_inverse(a, ALPHABET_SIZE));
 }
 
 int main(int const argc, char *const *const argv)
 {
 	enum cipher_mode cipher_mode = none;
+	bool read_files = false;
+	bool in_place = false;
+	bool crack = false;
+	size_t top = 5;
+	char const *keys_list = NULL;
+	char const *output = NULL;
+	size_t threads = 1;
 
 	static char const *const default_strings_list[] = {NULL};
+	static char const *const default_files_list[] = {"-", NULL};
 	char const *const *strings_list;
 
 	int c;
 
-	while((c = getopt_long(argc, argv, "deh", long_opts, NULL)) != -1) {
+	while((c = getopt_long(argc, argv, "cdefhiI:k:K:o:t:", long_opts, NULL)) != -1) {
 		switch(c) {
+			case 'c':
+				crack = true;
+				break;
 			case 'd':
 				cipher_mode = decrypt;
 				break;
 			case 'e':
 				cipher_mode = encrypt;
 				break;
+			case 'f':
+				read_files = true;
+				break;
 			case 'h':
 				usage(EXIT_SUCCESS, argv[0]);
 				break;
+			case 'i':
+				in_place = true;
+				break;
+			case 'I':
+				cpu_select(optarg);
+				break;
+			case 'k':
+				top = (size_t)strtoumax(optarg, NULL, 10);
+				break;
+			case 'K':
+				keys_list = optarg;
+				break;
+			case 'o':
+				output = optarg;
+				break;
+			case 't':
+				threads = parallel_threads(optarg);
+				break;
 			default:
 				usage(EXIT_FAILURE, argv[0]);
 		}
@@ -148,6 +560,108 @@ int main(int const argc, char *const *const argv)
 	if(cipher_mode == none)
 		cipher_mode = encrypt;
 
+	if(keys_list != NULL) {
+		if(crack || in_place)
+			error(EXIT_FAILURE, 0, "'--keys' cannot be combined with "
+								   "'--crack' or '--in-place'");
+
+		if(output == NULL)
+			error(EXIT_FAILURE, 0, "'--keys' requires '--output'");
+
+		struct affine_pair *list;
+		size_t const count = affine_keys(keys_list, &list);
+		struct affine_key *const keys = malloc(count * sizeof(*keys));
+		struct fanout f;
+
+		if(keys == NULL)
+			error(EXIT_FAILURE, errno, "error allocating keys");
+
+		fanout_init(&f, affine_kernel(), count);
+
+		for(size_t i = 0; i < count; ++i) {
+			char label[48];
+			snprintf(label, sizeof(label), "%jd:%jd", list[i].a, list[i].b);
+
+			affine_key(&keys[i], list[i].a, list[i].b, cipher_mode,
+					   mod_inverse(list[i].a, ALPHABET_SIZE));
+
+			char *const dest = fanout_dest(output, i, count, label);
+			fanout_add(&f, i, &keys[i], dest);
+			free(dest);
+		}
+
+		strings_list = (optind < argc
+						? (char const *const *) &argv[optind]
+						: default_files_list);
+
+		for(size_t i = 0; strings_list[i]; ++i)
+			fanout_file(&f, strings_list[i]);
+
+		fanout_close(&f);
+		free(keys);
+		free(list);
+		return EXIT_SUCCESS;
+	}
+
+	if(in_place && crack && optind >= argc)
+		error(EXIT_FAILURE, 0, "missing FILE for '--in-place', try '--help'");
+
+	if(crack) {
+		struct affine_key key;
+		struct histogram h = {{0}};
+
+		if(in_place || read_files) {
+			strings_list = (optind < argc
+							? (char const *const *) &argv[optind]
+							: default_files_list);
+
+			size_t count = 0;
+
+			while(strings_list[count])
+				++count;
+
+			struct crack_input *const inputs = malloc(count * sizeof(*inputs));
+
+			if(inputs == NULL)
+				error(EXIT_FAILURE, errno, "error allocating buffer");
+
+			for(size_t i = 0; i < count; ++i) {
+				crack_load(&inputs[i], strings_list[i]);
+				histogram_parallel(&h, inputs[i].buf, inputs[i].len, threads);
+			}
+
+			affine_crack_key(&key, &h, top);
+
+			for(size_t i = 0; i < count; ++i) {
+				if(in_place) {
+					crack_free(&inputs[i]);
+					inplace_file(strings_list[i], affine_kernel(), &key,
+								 threads);
+					continue;
+				}
+
+				affine_kernel()(inputs[i].buf, inputs[i].len, &key);
+				write_all(STDOUT_FILENO, inputs[i].buf, inputs[i].len);
+				crack_free(&inputs[i]);
+			}
+
+			free(inputs);
+			return EXIT_SUCCESS;
+		}
+
+		for(int i = optind; i < argc; ++i)
+			histogram_block(&h, argv[i], strlen(argv[i]));
+
+		affine_crack_key(&key, &h, top);
+
+		for(int i = optind; i < argc; ++i) {
+			table_puts(key.table, argv[i]);
+			putchar('\n');
+		}
+
+		return EXIT_SUCCESS;
+	}
+
 	char const *const a_tmp = argv[optind++];
 	char const *const b_tmp = argv[optind++];
 
@@ -167,16 +681,40 @@ int main(int const argc, char *const *const argv)
 								ALPHABET_SIZE);
 	}
 
+	/* Only required for decrypt */
+	intmax_t const mod_inv = mod_inverse(a, ALPHABET_SIZE);
+
+	struct affine_key key;
+	affine_key(&key, a, b, cipher_mode, mod_inv);
+
+	if(in_place) {
+		if(optind >= argc)
+			error(EXIT_FAILURE, 0, "missing FILE for '--in-place', "
+								   "try '--help'");
+
+		for(int i = optind; i < argc; ++i)
+			inplace_file(argv[i], affine_kernel(), &key, threads);
+
+		return EXIT_SUCCESS;
+	}
+
+	if(read_files) {
+		strings_list = (optind < argc
+						? (char const *const *) &argv[optind]
+						: default_files_list);
+
+		for(size_t i = 0; strings_list[i]; ++i)
+			parallel_file(strings_list[i], affine_kernel(), &key, threads);
+
+		return EXIT_SUCCESS;
+	}
+
 	strings_list = (optind < argc
 					? (char const *const *) &argv[optind]
 					: default_strings_list);
 
-	/* keep value between affine_cipher calls,
-		only required for decrypt */
-	intmax_t const mod_inv = mod_inverse(a, ALPHABET_SIZE);
-
 	for(size_t i = 0; strings_list[i]; ++i) {
-		affine_cipher(strings_list[i], a, b, cipher_mode, mod_inv);
+		table_puts(key.table, strings_list[i]);
 		putchar('\n');
 	}
 
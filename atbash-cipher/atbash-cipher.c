@@ -1,20 +1,40 @@
 /* atbash-cipher -- monoalphabetic substitution cipher */
 
 #include <ctype.h>
+#include <errno.h>
 #include <error.h>
 #include <getopt.h>
+#include <inttypes.h>
 #include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-/* Standard 26-character alphabet */
-#define ALPHABET_SIZE 26
+#include "../common/cipher.h"
+#include "../common/cpu.h"
+#include "../common/crack.h"
+#include "../common/inplace.h"
+#include "../common/parallel.h"
+#include "../common/quadgram.h"
+#include "../common/stream.h"
+#include "../common/subst.h"
+#include "../common/table.h"
 
 static struct option const long_opts[] = {
+	{"decrypt", no_argument, NULL, 'd'},
+	{"files", no_argument, NULL, 'f'},
 	{"help", no_argument, NULL, 'h'},
+	{"in-place", no_argument, NULL, 'i'},
+	{"isa", required_argument, NULL, 'I'},
 	{"print", no_argument, NULL, 'p'},
+	{"restarts", required_argument, NULL, 'r'},
+	{"solve", required_argument, NULL, 's'},
+	{"threads", required_argument, NULL, 't'},
 	{"unique", no_argument, NULL, 'u'},
 
 	{NULL, 0, NULL, 0}
@@ -23,14 +43,37 @@ static struct option const long_opts[] = {
 static _Noreturn void usage(int const status, char const *const name)
 {
 	printf("Usage: %s [OPTION]... KEY [STRING]...\n", name);
+	printf("  or:  %s [OPTION]... -f KEY [FILE]...\n", name);
+	printf("  or:  %s [OPTION]... -i KEY FILE...\n", name);
+	printf("  or:  %s [OPTION]... -s QUADGRAMS [-f|-i] [STRING/FILE]...\n",
+		   name);
 	if(status != EXIT_SUCCESS) {
 		fprintf(stderr, "Try '%s --help' for more information.\n", name);
 	} else {
 		puts("Monoalphabetic substitution cipher.");
 		printf("Example: %s -u -p bcdefghijklmnopqrstuvwxyza Hello\n", name);
 		puts("\nOptions:\n\
+  -d, --decrypt   substitute with the inverse of KEY\n\
+  -f, --files     read input from FILEs instead of STRINGs;\n\
+                  with no FILE, or when FILE is -, read\n\
+                  standard input\n\
   -h, --help      display this help text and exit\n\
+  -i, --in-place  substitute FILEs in place instead of\n\
+                  printing them\n\
+  -I, --isa=TIER  force the scalar, sse2, avx2 or avx512\n\
+                  kernels (default: widest supported,\n\
+                  or $CIPHER_ISA)\n\
   -p, --print     print the key and normal alphabet for comparison\n\
+  -r, --restarts=N\n\
+                  with '--solve', climb from N random keys\n\
+                  (default: 32)\n\
+  -s, --solve=QUADGRAMS\n\
+                  recover an unknown KEY by hill climbing on\n\
+                  the quadgram counts of the input, scored with\n\
+                  the \"ABCD COUNT\" lines of QUADGRAMS; print\n\
+                  the key to standard error and decrypt\n\
+  -t, --threads=N transform FILEs, or climb, on N threads;\n\
+                  0 uses one per processor\n\
   -u, --unique    check key for alphabetic uniqueness");
 	}
 
@@ -63,41 +106,340 @@ static bool stralpha(char const *c)
 	return true;
 }
 
-/* Assumes contiguous character encoding from a-z A-Z */
-static char exchange_char(char const ch, char const *const key)
+/* Random restarts run when solving, unless '--restarts' says otherwise */
+#define SOLVE_RESTARTS 32
+
+/* Distinct quadgram of the ciphertext */
+struct quad {
+	unsigned char letter[4];
+	uint32_t letters;
+	uint32_t count;
+};
+
+/* Everything a hill climb reads, shared by all threads */
+struct solver {
+	float const *logp;
+
+	struct quad *quad;
+	size_t count;
+
+	/* Quadgrams holding each cipher letter */
+	size_t *by_letter[ALPHABET_SIZE];
+	size_t by_letter_count[ALPHABET_SIZE];
+
+	size_t restarts;
+	atomic_size_t next;
+
+	pthread_mutex_t lock;
+	double best_score;
+	size_t best_restart;
+	unsigned char best[ALPHABET_SIZE];
+};
+
+/* Count the quadgrams of the letters of BUF, case folded and ignoring
+	everything else, into COUNTS; STATE carries the last three letters
+	across calls */
+static void solver_count(uint32_t *const counts, uint32_t *const state,
+						 char const *const buf, size_t const len)
+{
+	uint32_t s = *state;
+
+	for(size_t i = 0; i < len; ++i) {
+		unsigned const l = (unsigned)(tolower((unsigned char)buf[i]) - 'a');
+
+		if(l >= ALPHABET_SIZE)
+			continue;
+
+		/* Low 30 bits: letters seen (up to 3) and a base-26 window */
+		uint32_t const seen = s >> 30;
+		uint32_t const window = (s & 0x3fffffff) % (ALPHABET_SIZE
+			* ALPHABET_SIZE * ALPHABET_SIZE) * ALPHABET_SIZE + l;
+
+		if(seen == 3)
+			++counts[window];
+
+		s = ((seen < 3 ? seen + 1 : 3) << 30) | window;
+	}
+
+	*state = s;
+}
+
+/* Keep only the quadgrams that occur, grouped by cipher letter */
+static void solver_init(struct solver *const sv, float const *const logp,
+						uint32_t const *const counts)
+{
+	memset(sv, 0, sizeof(*sv));
+	sv->logp = logp;
+
+	for(size_t q = 0; q < QUADGRAM_SIZE; ++q)
+		sv->count += counts[q] != 0;
+
+	sv->quad = malloc((sv->count + 1) * sizeof(*sv->quad));
+
+	if(sv->quad == NULL)
+		error(EXIT_FAILURE, errno, "error allocating quadgrams");
+
+	size_t n = 0;
+
+	for(size_t q = 0; q < QUADGRAM_SIZE; ++q) {
+		if(counts[q] == 0)
+			continue;
+
+		struct quad *const g = &sv->quad[n++];
+		size_t v = q;
+
+		g->count = counts[q];
+		g->letters = 0;
+
+		for(size_t i = 4; i-- > 0; v /= ALPHABET_SIZE) {
+			g->letter[i] = (unsigned char)(v % ALPHABET_SIZE);
+			g->letters |= (uint32_t)1 << g->letter[i];
+		}
+
+		for(size_t l = 0; l < ALPHABET_SIZE; ++l)
+			sv->by_letter_count[l] += (g->letters >> l) & 1;
+	}
+
+	for(size_t l = 0; l < ALPHABET_SIZE; ++l) {
+		sv->by_letter[l] = malloc((sv->by_letter_count[l] + 1)
+								  * sizeof(*sv->by_letter[l]));
+
+		if(sv->by_letter[l] == NULL)
+			error(EXIT_FAILURE, errno, "error allocating quadgrams");
+
+		sv->by_letter_count[l] = 0;
+	}
+
+	for(size_t i = 0; i < sv->count; ++i) {
+		for(size_t l = 0; l < ALPHABET_SIZE; ++l) {
+			if((sv->quad[i].letters >> l) & 1)
+				sv->by_letter[l][sv->by_letter_count[l]++] = i;
+		}
+	}
+
+	pthread_mutex_init(&sv->lock, NULL);
+	sv->best_score = -HUGE_VAL;
+}
+
+/* Log-probability of one quadgram under the decryption DEC */
+static inline double solver_quad(struct solver const *const sv,
+								 struct quad const *const g,
+								 unsigned char const *const dec)
 {
-	if(ch >= 'a' && ch <= 'z')
-		return key[ch - 'a'];
-	else if(ch >= 'A' && ch <= 'Z')
-		return (char)toupper(key[ch - 'A']);
+	return g->count * (double)sv->logp[quadgram_index(dec[g->letter[0]],
+		dec[g->letter[1]], dec[g->letter[2]], dec[g->letter[3]])];
+}
+
+static double solver_score(struct solver const *const sv,
+						   unsigned char const *const dec)
+{
+	double score = 0;
+
+	for(size_t i = 0; i < sv->count; ++i)
+		score += solver_quad(sv, &sv->quad[i], dec);
+
+	return score;
+}
+
+/* Score of the quadgrams holding cipher letter X or Y, the only ones a
+	swap of X and Y changes */
+static double solver_partial(struct solver const *const sv,
+							 unsigned char const *const dec,
+							 size_t const x, size_t const y)
+{
+	double score = 0;
+
+	for(size_t i = 0; i < sv->by_letter_count[x]; ++i)
+		score += solver_quad(sv, &sv->quad[sv->by_letter[x][i]], dec);
+
+	for(size_t i = 0; i < sv->by_letter_count[y]; ++i) {
+		struct quad const *const g = &sv->quad[sv->by_letter[y][i]];
 
-	return ch;
+		if(!((g->letters >> x) & 1))
+			score += solver_quad(sv, g, dec);
+	}
+
+	return score;
+}
+
+/* splitmix64, seeded from the restart number so results do not depend
+	on the number of threads */
+static uint64_t solver_random(uint64_t *const state)
+{
+	uint64_t z = (*state += UINT64_C(0x9e3779b97f4a7c15));
+	z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+	z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+	return z ^ (z >> 31);
 }
 
-static void atbash_cipher(char const *const string, char const *const key)
+/* Climb from a random decryption until no swap of two letters helps */
+static double solver_climb(struct solver const *const sv,
+						   unsigned char *const dec, size_t const restart)
 {
-	for(size_t i = 0; string[i]; ++i)
-		putchar(exchange_char(string[i], key));
+	uint64_t state = restart;
+
+	for(size_t i = 0; i < ALPHABET_SIZE; ++i)
+		dec[i] = (unsigned char)i;
+
+	for(size_t i = ALPHABET_SIZE - 1; i > 0; --i) {
+		size_t const j = solver_random(&state) % (i + 1);
+		unsigned char const t = dec[i];
+		dec[i] = dec[j];
+		dec[j] = t;
+	}
+
+	double score = solver_score(sv, dec);
+	bool improved = true;
+
+	while(improved) {
+		improved = false;
+
+		for(size_t x = 0; x < ALPHABET_SIZE; ++x) {
+			for(size_t y = x + 1; y < ALPHABET_SIZE; ++y) {
+				double const before = solver_partial(sv, dec, x, y);
+				unsigned char t = dec[x];
+
+				dec[x] = dec[y];
+				dec[y] = t;
+
+				double const after = solver_partial(sv, dec, x, y);
+
+				if(after > before) {
+					score += after - before;
+					improved = true;
+				} else {
+					t = dec[x];
+					dec[x] = dec[y];
+					dec[y] = t;
+				}
+			}
+		}
+	}
+
+	return score;
+}
+
+/* Take restarts off the shared counter until none are left */
+static void *solver_worker(void *const data)
+{
+	struct solver *const sv = data;
+	unsigned char dec[ALPHABET_SIZE];
+	size_t restart;
+
+	while((restart = atomic_fetch_add(&sv->next, 1)) < sv->restarts) {
+		double const score = solver_climb(sv, dec, restart);
+
+		pthread_mutex_lock(&sv->lock);
+
+		if(score > sv->best_score || (score == sv->best_score
+									  && restart < sv->best_restart)) {
+			sv->best_score = score;
+			sv->best_restart = restart;
+			memcpy(sv->best, dec, sizeof(dec));
+		}
+
+		pthread_mutex_unlock(&sv->lock);
+	}
+
+	return NULL;
+}
+
+/* Run every restart on THREADS threads, the best decryption ends up in
+	sv->best */
+static void solver_run(struct solver *const sv, size_t const restarts,
+					   size_t threads)
+{
+	sv->restarts = restarts;
+	atomic_init(&sv->next, 0);
+
+	if(threads < 1)
+		threads = 1;
+	if(threads > restarts)
+		threads = restarts;
+
+	pthread_t *const pool = malloc(threads * sizeof(*pool));
+
+	if(pool == NULL)
+		error(EXIT_FAILURE, errno, "error allocating threads");
+
+	int err;
+
+	for(size_t i = 1; i < threads; ++i) {
+		if((err = pthread_create(&pool[i], NULL, solver_worker, sv)))
+			error(EXIT_FAILURE, err, "error creating threads");
+	}
+
+	solver_worker(sv);
+
+	for(size_t i = 1; i < threads; ++i)
+		pthread_join(pool[i], NULL);
+
+	free(pool);
+}
+
+/* Turn the best decryption into a KEY and the substitution undoing it */
+static void solver_key(struct solver const *const sv, char *const key,
+					   struct subst_key *const subst)
+{
+	char inverse[ALPHABET_SIZE + 1];
+
+	for(size_t c = 0; c < ALPHABET_SIZE; ++c) {
+		key[sv->best[c]] = (char)('a' + c);
+		inverse[c] = (char)('a' + sv->best[c]);
+	}
+
+	key[ALPHABET_SIZE] = inverse[ALPHABET_SIZE] = '\0';
+
+	exchange_table(subst->table, inverse);
+	subst_compile(subst);
 }
 
 int main(int const argc, char *const *const argv)
 {
 	bool check_unique = false;
+	bool decrypt = false;
 	bool print_comparison = false;
+	bool read_files = false;
+	bool in_place = false;
+	size_t threads = 1;
+	char const *quadgrams = NULL;
+	size_t restarts = SOLVE_RESTARTS;
 
 	static char const *const default_strings_list[] = {NULL};
+	static char const *const default_files_list[] = {"-", NULL};
 	char const *const *strings_list;
 
 	int c;
 
-	while((c = getopt_long(argc, argv, "hpu", long_opts, NULL)) != -1) {
+	while((c = getopt_long(argc, argv, "dfhiI:pr:s:t:u", long_opts, NULL)) != -1) {
 		switch(c) {
+			case 'd':
+				decrypt = true;
+				break;
+			case 'f':
+				read_files = true;
+				break;
 			case 'h':
 				usage(EXIT_SUCCESS, argv[0]);
 				break;
+			case 'i':
+				in_place = true;
+				break;
+			case 'I':
+				cpu_select(optarg);
+				break;
 			case 'p':
 				print_comparison = true;
 				break;
+			case 'r':
+				restarts = (size_t)strtoumax(optarg, NULL, 10);
+				break;
+			case 's':
+				quadgrams = optarg;
+				break;
+			case 't':
+				threads = parallel_threads(optarg);
+				break;
 			case 'u':
 				check_unique = true;
 				break;
@@ -106,6 +448,77 @@ int main(int const argc, char *const *const argv)
 		}
 	}
 
+	if(quadgrams != NULL) {
+		if(in_place && optind >= argc)
+			error(EXIT_FAILURE, 0, "missing FILE for '--in-place', "
+								   "try '--help'");
+
+		if(restarts == 0)
+			error(EXIT_FAILURE, 0, "'--restarts' must be at least 1");
+
+		static uint32_t counts[QUADGRAM_SIZE];
+		static struct solver sv;
+		float *const logp = quadgram_load(quadgrams);
+		uint32_t window = 0;
+
+		struct crack_input *inputs = NULL;
+		size_t count = 0;
+
+		if(in_place || read_files) {
+			strings_list = (optind < argc
+							? (char const *const *) &argv[optind]
+							: default_files_list);
+
+			while(strings_list[count])
+				++count;
+
+			if((inputs = malloc(count * sizeof(*inputs))) == NULL)
+				error(EXIT_FAILURE, errno, "error allocating buffer");
+
+			for(size_t i = 0; i < count; ++i) {
+				crack_load(&inputs[i], strings_list[i]);
+				solver_count(counts, &window, inputs[i].buf, inputs[i].len);
+			}
+		} else {
+			for(int i = optind; i < argc; ++i)
+				solver_count(counts, &window, argv[i], strlen(argv[i]));
+		}
+
+		solver_init(&sv, logp, counts);
+		solver_run(&sv, restarts, threads);
+
+		char solved[ALPHABET_SIZE + 1];
+		struct subst_key subst;
+
+		solver_key(&sv, solved, &subst);
+		fprintf(stderr, "key %s: score %.2f\n", solved, sv.best_score);
+
+		if(inputs == NULL) {
+			for(int i = optind; i < argc; ++i) {
+				table_puts(subst.table, argv[i]);
+				putchar('\n');
+			}
+
+			return EXIT_SUCCESS;
+		}
+
+		for(size_t i = 0; i < count; ++i) {
+			if(in_place) {
+				crack_free(&inputs[i]);
+				inplace_file(inputs[i].path, subst_kernel(&subst), &subst,
+							 threads);
+				continue;
+			}
+
+			subst_kernel(&subst)(inputs[i].buf, inputs[i].len, &subst);
+			write_all(STDOUT_FILENO, inputs[i].buf, inputs[i].len);
+			crack_free(&inputs[i]);
+		}
+
+		free(inputs);
+		return EXIT_SUCCESS;
+	}
+
 	char const *const key = argv[optind++];
 
 	if(key == NULL)
@@ -127,12 +540,43 @@ int main(int const argc, char *const *const argv)
 		putchar('\n');
 	}
 
+	char inverse[ALPHABET_SIZE + 1];
+
+	if(decrypt && !invert_key(inverse, key))
+		error(EXIT_FAILURE, 0, "key must be unique to decrypt");
+
+	struct subst_key subst;
+	exchange_table(subst.table, decrypt ? inverse : key);
+	subst_compile(&subst);
+
+	if(in_place) {
+		if(optind >= argc)
+			error(EXIT_FAILURE, 0, "missing FILE for '--in-place', "
+								   "try '--help'");
+
+		for(int i = optind; i < argc; ++i)
+			inplace_file(argv[i], subst_kernel(&subst), &subst, threads);
+
+		return EXIT_SUCCESS;
+	}
+
+	if(read_files) {
+		strings_list = (optind < argc
+						? (char const *const *) &argv[optind]
+						: default_files_list);
+
+		for(size_t i = 0; strings_list[i]; ++i)
+			parallel_file(strings_list[i], subst_kernel(&subst), &subst, threads);
+
+		return EXIT_SUCCESS;
+	}
+
 	strings_list = (optind < argc
 					? (char const *const *) &argv[optind]
 					: default_strings_list);
 
 	for(size_t i = 0; strings_list[i]; ++i) {
-		atbash_cipher(strings_list[i], key);
+		table_puts(subst.table, strings_list[i]);
 		putchar('\n');
 	}
 
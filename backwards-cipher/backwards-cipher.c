@@ -1,12 +1,31 @@
 /* backwards-cipher -- print strings backwards */
 
+#include <errno.h>
+#include <error.h>
 #include <getopt.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../common/cpu.h"
+#include "../common/reverse.h"
+#include "../common/scan.h"
+#include "../common/stream.h"
+
+/* What gets reversed */
+enum reverse_mode {
+	whole, lines, words
+};
 
 static struct option const long_opts[] = {
+	{"files", no_argument, NULL, 'f'},
 	{"help", no_argument, NULL, 'h'},
+	{"isa", required_argument, NULL, 'I'},
+	{"lines", no_argument, NULL, 'l'},
+	{"words", no_argument, NULL, 'w'},
 
 	{NULL, 0, NULL, 0}
 };
@@ -14,13 +33,23 @@ static struct option const long_opts[] = {
 static _Noreturn void usage(int const status, char const *const name)
 {
 	printf("Usage: %s [OPTION]... [STRING]...\n", name);
+	printf("  or:  %s [OPTION]... -f [FILE]...\n", name);
 	if(status != EXIT_SUCCESS) {
 		fprintf(stderr, "Try '%s --help' for more information.\n", name);
 	} else {
 		puts("Print strings backwards.");
 		printf("Example: %s Hello World\n", name);
 		puts("\nOptions:\n\
-  -h, --help    display this help text and exit");
+  -f, --files       reverse each FILE as a whole instead of\n\
+                    STRINGs; with no FILE, or when FILE is -,\n\
+                    read standard input\n\
+  -h, --help        display this help text and exit\n\
+  -I, --isa=TIER    force the scalar, sse2, avx2 or avx512\n\
+                    kernels (default: widest supported,\n\
+                    or $CIPHER_ISA)\n\
+  -l, --lines       reverse each line on its own\n\
+  -w, --words       reverse each whitespace-delimited word\n\
+                    on its own");
 	}
 
 	exit(status);
@@ -32,29 +61,216 @@ void backwards_cipher(char const *const string)
 		putchar(string[i - 1]);
 }
 
+static void pread_all(int const fd, char *const buf, size_t const len,
+					  off_t const offset, char const *const path)
+{
+	size_t done = 0;
+
+	while(done < len) {
+		ssize_t const n = pread(fd, buf + done, len - done,
+								offset + (off_t)done);
+
+		if(n < 0) {
+			if(errno == EINTR)
+				continue;
+			error(EXIT_FAILURE, errno, "%s", path);
+		} else if(n == 0) {
+			error(EXIT_FAILURE, 0, "%s: file shrank while reading", path);
+		}
+
+		done += (size_t)n;
+	}
+}
+
+/* Copy an unseekable input (a pipe or terminal) into an anonymous
+	temporary file, so it can be read from the end in constant memory */
+static int spool(int const fd, char const *const path)
+{
+	static char buf[STREAM_BUFFER_SIZE];
+
+	FILE *const tmp = tmpfile();
+
+	if(tmp == NULL)
+		error(EXIT_FAILURE, errno, "error creating temporary file");
+
+	int const tmp_fd = dup(fileno(tmp));
+
+	if(tmp_fd < 0)
+		error(EXIT_FAILURE, errno, "error creating temporary file");
+
+	fclose(tmp);
+
+	size_t n;
+
+	while((n = read_full(fd, buf, sizeof(buf), path)) != 0)
+		write_all(tmp_fd, buf, n);
+
+	stream_close(fd, path);
+
+	return tmp_fd;
+}
+
+/* Reverse a whole file by reading fixed-size blocks from its end */
+static void backwards_file(char const *const path, reverse_fn *const reverse)
+{
+	static char in[STREAM_BUFFER_SIZE];
+	static char out[STREAM_BUFFER_SIZE];
+
+	int fd = stream_open(path);
+	struct stat st;
+
+	if(fstat(fd, &st) != 0)
+		error(EXIT_FAILURE, errno, "%s", path);
+
+	if(!S_ISREG(st.st_mode) || lseek(fd, 0, SEEK_CUR) != 0) {
+		fd = spool(fd, path);
+		if(fstat(fd, &st) != 0)
+			error(EXIT_FAILURE, errno, "%s", path);
+	}
+
+	off_t offset = st.st_size;
+
+	while(offset > 0) {
+		size_t const len = (offset < (off_t)sizeof(in)
+							? (size_t)offset
+							: sizeof(in));
+		offset -= (off_t)len;
+
+		/* Readahead only works forwards, ask for the next block early */
+		if(offset > 0) {
+			off_t const next = offset < (off_t)sizeof(in) ? 0
+							   : offset - (off_t)sizeof(in);
+			(void)posix_fadvise(fd, next, offset - next,
+								POSIX_FADV_WILLNEED);
+		}
+
+		pread_all(fd, in, len, offset, path);
+		reverse(out, in, len);
+		write_all(STDOUT_FILENO, out, len);
+	}
+
+	stream_close(fd, path);
+}
+
+/* Reverse each segment of a file, the buffer only grows to hold the
+	longest segment */
+static void backwards_segments(char const *const path, scan_fn *const scan,
+							   reverse_inplace_fn *const reverse)
+{
+	static char *buf;
+	static size_t size;
+
+	if(buf == NULL) {
+		size = STREAM_BUFFER_SIZE;
+		if((buf = malloc(size)) == NULL)
+			error(EXIT_FAILURE, errno, "error allocating buffer");
+	}
+
+	int const fd = stream_open(path);
+	size_t pending = 0;
+
+	for(;;) {
+		if(pending == size) {
+			char *const grown = realloc(buf, 2 * size);
+			if(grown == NULL)
+				error(EXIT_FAILURE, errno, "error allocating buffer");
+			buf = grown;
+			size *= 2;
+		}
+
+		size_t const n = read_full(fd, buf + pending, size - pending, path);
+		char *const end = buf + pending + n;
+		char *const tail = reverse_segments(buf, buf + pending, end,
+											scan, reverse);
+
+		/* Short read, end of file */
+		if(end != buf + size) {
+			reverse(tail, (size_t)(end - tail));
+			write_all(STDOUT_FILENO, buf, (size_t)(end - buf));
+			break;
+		}
+
+		write_all(STDOUT_FILENO, buf, (size_t)(tail - buf));
+		pending = (size_t)(end - tail);
+		memmove(buf, tail, pending);
+	}
+
+	stream_close(fd, path);
+}
+
 int main(int const argc, char *const *const argv)
 {
+	bool read_files = false;
+	enum reverse_mode reverse_mode = whole;
+
 	static char const *const default_strings_list[] = {NULL};
+	static char const *const default_files_list[] = {"-", NULL};
 	char const *const *strings_list;
 
 	int c;
 
-	while((c = getopt_long(argc, argv, "h", long_opts, NULL)) != -1) {
+	while((c = getopt_long(argc, argv, "fhI:lw", long_opts, NULL)) != -1) {
 		switch(c) {
+			case 'f':
+				read_files = true;
+				break;
 			case 'h':
 				usage(EXIT_SUCCESS, argv[0]);
 				break;
+			case 'I':
+				cpu_select(optarg);
+				break;
+			case 'l':
+				reverse_mode = lines;
+				break;
+			case 'w':
+				reverse_mode = words;
+				break;
 			default:
 				usage(EXIT_FAILURE, argv[0]);
 		}
 	}
 
+	scan_fn *const scan = scan_kernel(reverse_mode == words);
+
+	if(read_files) {
+		strings_list = (optind < argc
+						? (char const *const *) &argv[optind]
+						: default_files_list);
+
+		for(size_t i = 0; strings_list[i]; ++i) {
+			if(reverse_mode == whole) {
+				backwards_file(strings_list[i], reverse_copy_kernel());
+			} else {
+				backwards_segments(strings_list[i], scan,
+								   reverse_inplace_kernel());
+			}
+		}
+
+		return EXIT_SUCCESS;
+	}
+
 	strings_list = (optind < argc
 					? (char const *const *) &argv[optind]
 					: default_strings_list);
 
 	for(size_t i = 0; strings_list[i]; ++i) {
-		backwards_cipher(strings_list[i]);
+		if(reverse_mode == whole) {
+			backwards_cipher(strings_list[i]);
+		} else {
+			size_t const len = strlen(strings_list[i]);
+			char *const string = strdup(strings_list[i]);
+
+			if(string == NULL)
+				error(EXIT_FAILURE, errno, "error allocating string");
+
+			char *const tail = reverse_segments(string, string, string + len,
+												scan, reverse_inplace_kernel());
+			reverse_inplace_kernel()(tail, (size_t)(string + len - tail));
+			fputs(string, stdout);
+			free(string);
+		}
+
 		putchar('\n');
 	}
 
@@ -7,24 +7,33 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-/* Standard 26-character alphabet */
-#define ALPHABET_SIZE 26
-
-/* Standard base-10 numeric system */
-#define NUMERIC_SIZE 10
-
-/* Least common multiple of alphabet and numeric size */
-#define LCM_ALPHA_NUM 130
+#include "../common/cipher.h"
+#include "../common/cpu.h"
+#include "../common/crack.h"
+#include "../common/fanout.h"
+#include "../common/histogram.h"
+#include "../common/inplace.h"
+#include "../common/parallel.h"
+#include "../common/stream.h"
+#include "../common/table.h"
 
 /* When to rotate numbers */
 static bool rotate_numbers;
 
 static struct option const long_opts[] = {
+	{"crack", no_argument, NULL, 'c'},
+	{"files", no_argument, NULL, 'f'},
 	{"help", no_argument, NULL, 'h'},
+	{"in-place", no_argument, NULL, 'i'},
+	{"isa", required_argument, NULL, 'I'},
+	{"keys", required_argument, NULL, 'K'},
 	{"no-shortcut", no_argument, NULL, 's'},
 	{"numbers", no_argument, NULL, 'n'},
+	{"output", required_argument, NULL, 'o'},
 	{"rotations", required_argument, NULL, 'r'},
+	{"threads", required_argument, NULL, 't'},
 
 	{NULL, 0, NULL, 0}
 };
@@ -32,75 +41,354 @@ static struct option const long_opts[] = {
 static _Noreturn void usage(int const status, char const *const name)
 {
 	printf("Usage: %s [OPTION]... [STRING]...\n", name);
+	printf("  or:  %s [OPTION]... -f [FILE]...\n", name);
+	printf("  or:  %s [OPTION]... -i FILE...\n", name);
+	printf("  or:  %s [OPTION]... -K LIST -o DEST [FILE]...\n", name);
 	if(status != EXIT_SUCCESS) {
 		fprintf(stderr, "Try '%s --help' for more information.\n", name);
 	} else {
 		puts("Rotate strings through the alphabet.");
 		printf("Example: %s -n -r 25 \"Hello 123 World!\"\n", name);
 		puts("\nOptions:\n\
+  -c, --crack            find the rotation by letter frequency\n\
+                         analysis, print the ranked rotations to\n\
+                         standard error and undo the best one;\n\
+                         '--rotations' is ignored\n\
+  -f, --files            read input from FILEs instead of STRINGs;\n\
+                         with no FILE, or when FILE is -, read\n\
+                         standard input\n\
   -h, --help             display this help text and exit\n\
+  -i, --in-place         rotate FILEs in place instead of\n\
+                         printing them\n\
+  -I, --isa=TIER         force the scalar, sse2, avx2 or avx512\n\
+                         kernels (default: widest supported,\n\
+                         or $CIPHER_ISA)\n\
+  -K, --keys=LIST        rotate FILEs by every rotation in LIST,\n\
+                         e.g. 0-25 or 1,3,7, reading them once\n\
   -s, --no-shortcut      do not use a shortcut to reduce\n\
                          redundant rotations\n\
   -n, --numbers          rotate numbers alongside letters\n\
+  -o, --output=DEST      with '--keys', write each rotation to\n\
+                         DEST with {} replaced by the rotation,\n\
+                         or to the matching entry of a comma-\n\
+                         separated DEST; &N is descriptor N\n\
   -r, --rotations=NUM    rotate the input string NUM times;\n\
-                         defaults to one rotation");
+                         defaults to one rotation\n\
+  -t, --threads=NUM      transform FILEs on NUM threads;\n\
+                         0 uses one per processor");
 	}
 
 	exit(status);
 }
 
-/* Assumes contiguous character encoding from a-z A-Z */
-static char rotate_char(char const ch, uintmax_t const rotations)
+/* Compiled rotation, shared by the table and vector kernels */
+struct caesar_key {
+	table_t table;
+	char alpha_rot;
+	char num_rot;
+};
+
+/* Compile the rotation once, rotate_char stays the reference */
+static void caesar_key(struct caesar_key *const key, uintmax_t const rotations)
 {
-	uintmax_t rot_ch;
+	rotate_table(key->table, rotations, rotate_numbers);
 
-	if(ch >= 'a' && ch <= 'z')
-		rot_ch = 'a';
-	else if(ch >= 'A' && ch <= 'Z')
-		rot_ch = 'A';
-	else if(rotate_numbers && (ch >= '0' && ch <= '9'))
-		rot_ch = '0';
-	else
-		return ch;
+	key->alpha_rot = (char)(rotations % ALPHABET_SIZE);
+	key->num_rot = rotate_numbers ? (char)(rotations % NUMERIC_SIZE) : 0;
+}
+
+static void caesar_block_scalar(char *const buf, size_t const len,
+								void const *const arg)
+{
+	struct caesar_key const *const key = arg;
+	table_apply(key->table, buf, len);
+}
 
-	uintmax_t const mod = rotate_numbers ? NUMERIC_SIZE : ALPHABET_SIZE;
+#ifdef CPU_X86
+/* Offset to add to bytes in [base, base + size) to rotate them by rot,
+	zero for every other byte; rot must be less than size */
+__attribute__((target("sse2")))
+static inline __m128i rotate_range_sse2(__m128i const x, char const base,
+										char const size, char const rot)
+{
+	__m128i const d = _mm_sub_epi8(x, _mm_set1_epi8(base));
+	__m128i const in = _mm_cmpeq_epi8(
+		_mm_min_epu8(d, _mm_set1_epi8((char)(size - 1))), d);
+	__m128i const wrap = _mm_cmpeq_epi8(
+		_mm_max_epu8(d, _mm_set1_epi8((char)(size - rot))), d);
 
-	return (char)(rot_ch + (((uintmax_t)ch - rot_ch + rotations) % mod));
+	return _mm_and_si128(in, _mm_sub_epi8(_mm_set1_epi8(rot),
+		_mm_and_si128(wrap, _mm_set1_epi8(size))));
 }
 
-static void caesar_cipher(char const *const string, uintmax_t const rotations)
+__attribute__((target("sse2")))
+static void caesar_block_sse2(char *const buf, size_t const len,
+							  void const *const arg)
 {
-	for(size_t i = 0; string[i]; ++i)
-		putchar(rotate_char(string[i], rotations));
+	struct caesar_key const *const key = arg;
+	size_t i = 0;
+
+	for(; i + 16 <= len; i += 16) {
+		__m128i const x = _mm_loadu_si128((__m128i const *)(buf + i));
+		__m128i delta = _mm_add_epi8(
+			rotate_range_sse2(x, 'a', ALPHABET_SIZE, key->alpha_rot),
+			rotate_range_sse2(x, 'A', ALPHABET_SIZE, key->alpha_rot));
+
+		if(key->num_rot != 0) {
+			delta = _mm_add_epi8(delta,
+				rotate_range_sse2(x, '0', NUMERIC_SIZE, key->num_rot));
+		}
+
+		_mm_storeu_si128((__m128i *)(buf + i), _mm_add_epi8(x, delta));
+	}
+
+	table_apply(key->table, buf + i, len - i);
+}
+
+/* Same as rotate_range_sse2, 32 bytes at a time */
+__attribute__((target("avx2")))
+static inline __m256i rotate_range_avx2(__m256i const x, char const base,
+										char const size, char const rot)
+{
+	__m256i const d = _mm256_sub_epi8(x, _mm256_set1_epi8(base));
+	__m256i const in = _mm256_cmpeq_epi8(
+		_mm256_min_epu8(d, _mm256_set1_epi8((char)(size - 1))), d);
+	__m256i const wrap = _mm256_cmpeq_epi8(
+		_mm256_max_epu8(d, _mm256_set1_epi8((char)(size - rot))), d);
+
+	return _mm256_and_si256(in, _mm256_sub_epi8(_mm256_set1_epi8(rot),
+		_mm256_and_si256(wrap, _mm256_set1_epi8(size))));
+}
+
+__attribute__((target("avx2")))
+static void caesar_block_avx2(char *const buf, size_t const len,
+							  void const *const arg)
+{
+	struct caesar_key const *const key = arg;
+	size_t i = 0;
+
+	for(; i + 32 <= len; i += 32) {
+		__m256i const x = _mm256_loadu_si256((__m256i const *)(buf + i));
+		__m256i delta = _mm256_add_epi8(
+			rotate_range_avx2(x, 'a', ALPHABET_SIZE, key->alpha_rot),
+			rotate_range_avx2(x, 'A', ALPHABET_SIZE, key->alpha_rot));
+
+		if(key->num_rot != 0) {
+			delta = _mm256_add_epi8(delta,
+				rotate_range_avx2(x, '0', NUMERIC_SIZE, key->num_rot));
+		}
+
+		_mm256_storeu_si256((__m256i *)(buf + i), _mm256_add_epi8(x, delta));
+	}
+
+	table_apply(key->table, buf + i, len - i);
+}
+
+/* Same as rotate_range_sse2 with mask registers, 64 bytes at a time */
+__attribute__((target("avx512f,avx512bw")))
+static inline __m512i rotate_range_avx512(__m512i const x, char const base,
+										  char const size, char const rot)
+{
+	__m512i const d = _mm512_sub_epi8(x, _mm512_set1_epi8(base));
+	__mmask64 const in = _mm512_cmplt_epu8_mask(d, _mm512_set1_epi8(size));
+	__mmask64 const wrap = in & _mm512_cmpge_epu8_mask(d,
+		_mm512_set1_epi8((char)(size - rot)));
+
+	return _mm512_mask_blend_epi8(wrap,
+		_mm512_maskz_mov_epi8(in, _mm512_set1_epi8(rot)),
+		_mm512_set1_epi8((char)(rot - size)));
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void caesar_block_avx512(char *const buf, size_t const len,
+								void const *const arg)
+{
+	struct caesar_key const *const key = arg;
+	size_t i = 0;
+
+	for(; i + 64 <= len; i += 64) {
+		__m512i const x = _mm512_loadu_si512(buf + i);
+		__m512i delta = _mm512_add_epi8(
+			rotate_range_avx512(x, 'a', ALPHABET_SIZE, key->alpha_rot),
+			rotate_range_avx512(x, 'A', ALPHABET_SIZE, key->alpha_rot));
+
+		if(key->num_rot != 0) {
+			delta = _mm512_add_epi8(delta,
+				rotate_range_avx512(x, '0', NUMERIC_SIZE, key->num_rot));
+		}
+
+		_mm512_storeu_si512(buf + i, _mm512_add_epi8(x, delta));
+	}
+
+	table_apply(key->table, buf + i, len - i);
+}
+#endif
+
+/* Kernel for the selected tier, caesar_block_scalar is the reference */
+static stream_fn *caesar_kernel(void)
+{
+	switch(cpu_tier()) {
+#ifdef CPU_X86
+		case tier_avx512:
+			return caesar_block_avx512;
+		case tier_avx2:
+			return caesar_block_avx2;
+		case tier_sse2:
+			return caesar_block_sse2;
+#endif
+		default:
+			return caesar_block_scalar;
+	}
+}
+
+/* Parse the "N" and "N-M" entries of the comma-separated LIST, a range
+	spans at most one period of rotations. Returns the number of rotations
+	stored in the allocated *ROTATIONS */
+static size_t caesar_keys(char const *const list, uintmax_t **const rotations)
+{
+	uintmax_t const mod = rotate_numbers ? LCM_ALPHA_NUM : ALPHABET_SIZE;
+	size_t count = 0;
+	size_t cap = 0;
+	char const *p = list;
+
+	*rotations = NULL;
+
+	for(;;) {
+		char *end;
+		uintmax_t const first = strtoumax(p, &end, 10);
+		uintmax_t last = first;
+
+		if(end == p)
+			error(EXIT_FAILURE, 0, "invalid key list '%s'", list);
+
+		if(*end == '-') {
+			p = end + 1;
+			last = strtoumax(p, &end, 10);
+
+			if(end == p || last < first)
+				error(EXIT_FAILURE, 0, "invalid key list '%s'", list);
+
+			/* Every rotation past one period repeats an earlier one */
+			if(last - first >= mod)
+				error(EXIT_FAILURE, 0, "range %ju-%ju is longer than the %ju "
+					  "distinct rotations", first, last, mod);
+		}
+
+		for(uintmax_t r = first; ; ++r) {
+			if(count == cap) {
+				cap = cap ? cap * 2 : 32;
+				*rotations = realloc(*rotations, cap * sizeof(**rotations));
+
+				if(*rotations == NULL)
+					error(EXIT_FAILURE, errno, "error allocating keys");
+			}
+
+			(*rotations)[count++] = r;
+
+			if(r == last)
+				break;
+		}
+
+		if(*end == '\0')
+			return count;
+
+		if(*end != ',')
+			error(EXIT_FAILURE, 0, "invalid key list '%s'", list);
+
+		p = end + 1;
+	}
+}
+
+/* Rank every rotation from the histogram of the ciphertext: rotating
+	by R moves the count of plaintext letter j to (j + R) % 26, so each
+	candidate is scored without touching the data again */
+static size_t caesar_crack(struct crack_rank *const ranks,
+						   struct histogram const *const h)
+{
+	uint64_t letters[HISTOGRAM_LETTERS];
+	uint64_t digits[HISTOGRAM_DIGITS];
+	size_t const mod = rotate_numbers ? LCM_ALPHA_NUM : ALPHABET_SIZE;
+
+	histogram_letters(h, letters);
+	histogram_digits(h, digits);
+
+	for(size_t r = 0; r < mod; ++r) {
+		ranks[r].key = r;
+		ranks[r].score = histogram_chi(letters, english_freq,
+									   ALPHABET_SIZE, 1, r % ALPHABET_SIZE);
+
+		if(rotate_numbers) {
+			ranks[r].score += histogram_chi(digits, digit_freq,
+											NUMERIC_SIZE, 1, r % NUMERIC_SIZE);
+		}
+	}
+
+	crack_sort(ranks, mod);
+
+	for(size_t r = 0; r < mod; ++r) {
+		fprintf(stderr, "rotation %ju: chi-squared %.2f\n", ranks[r].key,
+				ranks[r].score);
+	}
+
+	/* Undo the winning rotation */
+	return (mod - ranks[0].key) % mod;
 }
 
 int main(int const argc, char *const *const argv)
 {
 	rotate_numbers = false;
 	bool rotation_shortcut = true;
+	bool read_files = false;
+	bool in_place = false;
+	bool crack = false;
+	char const *keys_list = NULL;
+	char const *output = NULL;
+	size_t threads = 1;
 
 	/* Rotate once by default */
 	uintmax_t rotations = 1;
 
 	static char const *const default_strings_list[] = {NULL};
+	static char const *const default_files_list[] = {"-", NULL};
 	char const *const *strings_list;
 
 	int c;
 
-	while((c = getopt_long(argc, argv, "hnr:s", long_opts, NULL)) != -1) {
+	while((c = getopt_long(argc, argv, "cfhiI:K:no:r:st:", long_opts, NULL)) != -1) {
 		switch(c) {
+			case 'c':
+				crack = true;
+				break;
+			case 'f':
+				read_files = true;
+				break;
 			case 'h':
 				usage(EXIT_SUCCESS, argv[0]);
 				break;
+			case 'i':
+				in_place = true;
+				break;
+			case 'I':
+				cpu_select(optarg);
+				break;
+			case 'K':
+				keys_list = optarg;
+				break;
 			case 'n':
 				rotate_numbers = true;
 				break;
+			case 'o':
+				output = optarg;
+				break;
 			case 'r':
 				rotations = strtoumax(optarg, NULL, 10);
 				break;
 			case 's':
 				rotation_shortcut = false;
 				break;
+			case 't':
+				threads = parallel_threads(optarg);
+				break;
 			default:
 				usage(EXIT_FAILURE, argv[0]);
 		}
@@ -114,12 +402,129 @@ int main(int const argc, char *const *const argv)
 		rotations %= mod;
 	}
 
+	if(in_place && optind >= argc)
+		error(EXIT_FAILURE, 0, "missing FILE for '--in-place', try '--help'");
+
+	struct caesar_key key;
+	caesar_key(&key, rotations);
+
+	if(keys_list != NULL) {
+		if(crack || in_place)
+			error(EXIT_FAILURE, 0, "'--keys' cannot be combined with "
+								   "'--crack' or '--in-place'");
+
+		if(output == NULL)
+			error(EXIT_FAILURE, 0, "'--keys' requires '--output'");
+
+		uintmax_t *list;
+		size_t const count = caesar_keys(keys_list, &list);
+		struct caesar_key *const keys = malloc(count * sizeof(*keys));
+		struct fanout f;
+
+		if(keys == NULL)
+			error(EXIT_FAILURE, errno, "error allocating keys");
+
+		fanout_init(&f, caesar_kernel(), count);
+
+		for(size_t i = 0; i < count; ++i) {
+			char label[24];
+			snprintf(label, sizeof(label), "%ju", list[i]);
+
+			caesar_key(&keys[i], rotation_shortcut
+				? list[i] % (rotate_numbers ? LCM_ALPHA_NUM : ALPHABET_SIZE)
+				: list[i]);
+
+			char *const dest = fanout_dest(output, i, count, label);
+			fanout_add(&f, i, &keys[i], dest);
+			free(dest);
+		}
+
+		strings_list = (optind < argc
+						? (char const *const *) &argv[optind]
+						: default_files_list);
+
+		for(size_t i = 0; strings_list[i]; ++i)
+			fanout_file(&f, strings_list[i]);
+
+		fanout_close(&f);
+		free(keys);
+		free(list);
+		return EXIT_SUCCESS;
+	}
+
+	if(crack) {
+		struct crack_rank ranks[LCM_ALPHA_NUM];
+		struct histogram h = {{0}};
+
+		if(in_place || read_files) {
+			strings_list = (optind < argc
+							? (char const *const *) &argv[optind]
+							: default_files_list);
+
+			size_t count = 0;
+
+			while(strings_list[count])
+				++count;
+
+			struct crack_input *const inputs = malloc(count * sizeof(*inputs));
+
+			if(inputs == NULL)
+				error(EXIT_FAILURE, errno, "error allocating buffer");
+
+			for(size_t i = 0; i < count; ++i) {
+				crack_load(&inputs[i], strings_list[i]);
+				histogram_parallel(&h, inputs[i].buf, inputs[i].len, threads);
+			}
+
+			caesar_key(&key, caesar_crack(ranks, &h));
+
+			for(size_t i = 0; i < count; ++i) {
+				if(in_place) {
+					crack_free(&inputs[i]);
+					inplace_file(strings_list[i], caesar_kernel(), &key,
+								 threads);
+					continue;
+				}
+
+				caesar_kernel()(inputs[i].buf, inputs[i].len, &key);
+				write_all(STDOUT_FILENO, inputs[i].buf, inputs[i].len);
+				crack_free(&inputs[i]);
+			}
+
+			free(inputs);
+			return EXIT_SUCCESS;
+		}
+
+		for(int i = optind; i < argc; ++i)
+			histogram_block(&h, argv[i], strlen(argv[i]));
+
+		caesar_key(&key, caesar_crack(ranks, &h));
+	}
+
+	if(in_place) {
+		for(int i = optind; i < argc; ++i)
+			inplace_file(argv[i], caesar_kernel(), &key, threads);
+
+		return EXIT_SUCCESS;
+	}
+
+	if(read_files) {
+		strings_list = (optind < argc
+						? (char const *const *) &argv[optind]
+						: default_files_list);
+
+		for(size_t i = 0; strings_list[i]; ++i)
+			parallel_file(strings_list[i], caesar_kernel(), &key, threads);
+
+		return EXIT_SUCCESS;
+	}
+
 	strings_list = (optind < argc
 					? (char const *const *) &argv[optind]
 					: default_strings_list);
 
 	for(size_t i = 0; strings_list[i]; ++i) {
-		caesar_cipher(strings_list[i], rotations);
+		table_puts(key.table, strings_list[i]);
 		putchar('\n');
 	}
 
@@ -0,0 +1,592 @@
+/* cipher-pipeline -- run strings through a chain of ciphers */
+
+#include <ctype.h>
+#include <errno.h>
+#include <error.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../common/cipher.h"
+#include "../common/cpu.h"
+#include "../common/reverse.h"
+#include "../common/scan.h"
+#include "../common/stream.h"
+#include "../common/subst.h"
+#include "../common/table.h"
+
+/* Fields of a single step, the name included */
+#define STEP_FIELDS 4
+
+#define _warn(...) do {					\
+		if(!quiet)						\
+			error(0, 0, __VA_ARGS__);	\
+	} while(0)
+
+/* Disable warnings */
+static bool quiet;
+
+static struct option const long_opts[] = {
+	{"files", no_argument, NULL, 'f'},
+	{"help", no_argument, NULL, 'h'},
+	{"isa", required_argument, NULL, 'I'},
+	{"quiet", no_argument, NULL, 'q'},
+
+	{NULL, 0, NULL, 0}
+};
+
+static _Noreturn void usage(int const status, char const *const name)
+{
+	printf("Usage: %s [OPTION]... SPEC [STRING]...\n", name);
+	printf("  or:  %s [OPTION]... -f SPEC [FILE]...\n", name);
+	if(status != EXIT_SUCCESS) {
+		fprintf(stderr, "Try '%s --help' for more information.\n", name);
+	} else {
+		puts("Run strings through a chain of ciphers in one pass.");
+		printf("Example: %s caesar:3,affine:5:7,backwards \"Hello World\"\n",
+			   name);
+		puts("\nOptions:\n\
+  -f, --files       read input from FILEs instead of STRINGs;\n\
+                    with no FILE, or when FILE is -, read\n\
+                    standard input\n\
+  -h, --help        display this help text and exit\n\
+  -I, --isa=TIER    force the scalar, sse2, avx2 or avx512\n\
+                    kernels (default: widest supported,\n\
+                    or $CIPHER_ISA)\n\
+  -q, --quiet       disable warnings");
+		puts("\nSPEC is a comma-separated list of steps, applied in order:\n\
+  caesar:NUM[:n]            rotate letters NUM times, and numbers\n\
+                            too with n\n\
+  atbash:KEY[:d]            exchange letters for those of KEY, or\n\
+                            back with d\n\
+  affine:A:B[:d]            encrypt with A and B, or decrypt with d\n\
+  backwards[:lines|:words]  reverse the whole input, each line or\n\
+                            each word\n\
+  tokenize:SIZE[:DELIM[:CHAR]]\n\
+                            split into SIZE-character tokens\n\
+                            delimited by DELIM, padding the last\n\
+                            one with CHAR\n\
+\n\
+Consecutive caesar, atbash and affine steps are combined into a single\n\
+table before any input is read. Each STRING or FILE runs through the\n\
+pipeline on its own.");
+	}
+
+	exit(status);
+}
+
+static uintmax_t parse_number(char const *const string,
+							  char const *const what)
+{
+	char *end;
+
+	errno = 0;
+	uintmax_t const n = strtoumax(string, &end, 10);
+
+	if(end == string || *end != '\0' || !isdigit((unsigned char)string[0]))
+		error(EXIT_FAILURE, 0, "%s must be a number, got '%s'", what,
+			  string);
+	else if(n == UINTMAX_MAX && errno == ERANGE)
+		error(EXIT_FAILURE, 0, "%s: could not convert to integer (overflow)",
+			  what);
+
+	return n;
+}
+
+/* Optional last field of a step, which may only be FLAG */
+static bool parse_flag(char *const *const field, size_t const count,
+					   size_t const at, char const *const flag,
+					   char const *const name)
+{
+	if(count <= at)
+		return false;
+
+	if(strcmp(field[at], flag) != 0)
+		error(EXIT_FAILURE, 0, "%s: unknown flag '%s', expected '%s'", name,
+			  field[at], flag);
+
+	return true;
+}
+
+static void caesar_step(unsigned char *const table, char *const *const field,
+						size_t const count)
+{
+	if(count < 2 || count > 3)
+		error(EXIT_FAILURE, 0, "caesar takes NUM[:n], try '--help'");
+
+	uintmax_t const rotations = parse_number(field[1], "caesar rotations");
+	bool const numbers = parse_flag(field, count, 2, "n", "caesar");
+
+	rotate_table(table, rotations, numbers);
+}
+
+static void atbash_step(unsigned char *const table, char *const *const field,
+						size_t const count)
+{
+	if(count < 2 || count > 3)
+		error(EXIT_FAILURE, 0, "atbash takes KEY[:d], try '--help'");
+
+	char const *const key = field[1];
+	bool const decrypt = parse_flag(field, count, 2, "d", "atbash");
+
+	if(strlen(key) != ALPHABET_SIZE)
+		error(EXIT_FAILURE, 0, "atbash key must be %d characters long",
+			  ALPHABET_SIZE);
+
+	for(size_t i = 0; i < ALPHABET_SIZE; ++i) {
+		if(!isalpha((unsigned char)key[i]))
+			error(EXIT_FAILURE, 0, "atbash key must be alphabetic");
+	}
+
+	char inverse[ALPHABET_SIZE + 1];
+
+	if(decrypt && !invert_key(inverse, key))
+		error(EXIT_FAILURE, 0, "atbash key must be unique to decrypt");
+
+	exchange_table(table, decrypt ? inverse : key);
+}
+
+static void affine_step(unsigned char *const table, char *const *const field,
+						size_t const count)
+{
+	if(count < 3 || count > 4)
+		error(EXIT_FAILURE, 0, "affine takes A:B[:d], try '--help'");
+
+	intmax_t const a = (intmax_t)(parse_number(field[1], "affine A")
+								  % ALPHABET_SIZE);
+	intmax_t const b = (intmax_t)(parse_number(field[2], "affine B")
+								  % ALPHABET_SIZE);
+	bool const decrypt = parse_flag(field, count, 3, "d", "affine");
+
+	if(gcd(a, ALPHABET_SIZE) != 1)
+		error(EXIT_FAILURE, 0, "affine A must be coprime to %d, got %s",
+			  ALPHABET_SIZE, field[1]);
+
+	if(decrypt)
+		affine_decrypt_table(table, b, mod_inverse(a, ALPHABET_SIZE));
+	else
+		affine_encrypt_table(table, a, b);
+}
+
+/* Substitutions compose into one table, the rest hold state across
+	blocks */
+enum stage_type {
+	stage_subst, stage_reverse, stage_tokenize
+};
+
+struct stage {
+	enum stage_type type;
+
+	/* stage_subst */
+	struct subst_key key;
+	stream_fn *fn;
+
+	/* stage_reverse, the whole input when SCAN is NULL */
+	scan_fn *scan;
+	reverse_inplace_fn *reverse;
+
+	/* stage_reverse: bytes held back until they can be reversed,
+		stage_tokenize: output not yet passed on */
+	char *buf;
+	size_t len;
+	size_t size;
+
+	/* stage_tokenize */
+	uintmax_t token_size;
+	uintmax_t filled;
+	char const *delim;
+	size_t delim_len;
+	char padding;
+};
+
+struct pipeline {
+	struct stage *stage;
+	size_t count;
+
+	/* Copy of the spec, delimiters point into it */
+	char *spec;
+};
+
+static void backwards_step(struct stage *const s, char *const *const field,
+						   size_t const count)
+{
+	if(count > 2)
+		error(EXIT_FAILURE, 0, "backwards takes [lines|words], try '--help'");
+
+	s->type = stage_reverse;
+	s->reverse = reverse_inplace_kernel();
+	s->scan = NULL;
+
+	if(count == 2) {
+		if(strcmp(field[1], "lines") == 0)
+			s->scan = scan_kernel(false);
+		else if(strcmp(field[1], "words") == 0)
+			s->scan = scan_kernel(true);
+		else
+			error(EXIT_FAILURE, 0, "backwards: unknown mode '%s'", field[1]);
+	}
+}
+
+static void tokenize_step(struct stage *const s, char *const *const field,
+						  size_t const count)
+{
+	if(count < 2)
+		error(EXIT_FAILURE, 0, "tokenize takes SIZE[:DELIM[:CHAR]], "
+			  "try '--help'");
+
+	char const *const padding = count > 3 ? field[3] : " ";
+
+	s->type = stage_tokenize;
+	s->token_size = parse_number(field[1], "token size");
+	s->delim = count > 2 ? field[2] : " ";
+	s->delim_len = strlen(s->delim);
+
+	if(s->token_size == 0)
+		error(EXIT_FAILURE, 0, "token size must be greater than zero");
+
+	if(padding[0] == '\0')
+		error(EXIT_FAILURE, 0, "padding must be a character");
+	else if(strlen(padding) > 1)
+		_warn("padding only uses the first character specified");
+
+	s->padding = padding[0];
+	s->size = STREAM_BUFFER_SIZE;
+
+	if((s->buf = malloc(s->size)) == NULL)
+		error(EXIT_FAILURE, errno, "error allocating buffer");
+}
+
+/* Split SPEC into stages, composing each run of substitutions into the
+	table of its first step */
+static void pipeline_parse(struct pipeline *const p, char const *const spec)
+{
+	if((p->spec = strdup(spec)) == NULL)
+		error(EXIT_FAILURE, errno, "error allocating spec");
+
+	/* At most one stage per step */
+	size_t steps = 1;
+
+	for(char const *c = spec; *c; ++c)
+		steps += (*c == ',');
+
+	if((p->stage = calloc(steps, sizeof(*p->stage))) == NULL)
+		error(EXIT_FAILURE, errno, "error allocating pipeline");
+
+	p->count = 0;
+
+	char *rest = p->spec;
+	char *step;
+
+	while((step = strsep(&rest, ",")) != NULL) {
+		char *field[STEP_FIELDS];
+		size_t count = 0;
+
+		while(count < STEP_FIELDS && step != NULL)
+			field[count++] = strsep(&step, ":");
+
+		if(step != NULL)
+			error(EXIT_FAILURE, 0, "%s: too many fields", field[0]);
+
+		table_t table;
+
+		if(strcmp(field[0], "caesar") == 0) {
+			caesar_step(table, field, count);
+		} else if(strcmp(field[0], "atbash") == 0) {
+			atbash_step(table, field, count);
+		} else if(strcmp(field[0], "affine") == 0) {
+			affine_step(table, field, count);
+		} else if(strcmp(field[0], "backwards") == 0) {
+			backwards_step(&p->stage[p->count++], field, count);
+			continue;
+		} else if(strcmp(field[0], "tokenize") == 0) {
+			tokenize_step(&p->stage[p->count++], field, count);
+			continue;
+		} else {
+			error(EXIT_FAILURE, 0, "unknown step '%s', try '--help'",
+				  field[0]);
+		}
+
+		struct stage *const last = p->count ? &p->stage[p->count - 1] : NULL;
+
+		if(last != NULL && last->type == stage_subst) {
+			table_compose(last->key.table, table);
+			continue;
+		}
+
+		struct stage *const s = &p->stage[p->count++];
+
+		s->type = stage_subst;
+		memcpy(s->key.table, table, sizeof(table));
+	}
+
+	for(size_t i = 0; i < p->count; ++i) {
+		if(p->stage[i].type == stage_subst) {
+			subst_compile(&p->stage[i].key);
+			p->stage[i].fn = subst_kernel(&p->stage[i].key);
+		}
+	}
+}
+
+static void pipeline_push(struct pipeline *p, size_t i, char *buf,
+						  size_t len);
+
+/* Make room for LEN more held bytes */
+static void stage_reserve(struct stage *const s, size_t const len)
+{
+	if(s->size - s->len >= len)
+		return;
+
+	size_t size = s->size ? s->size : STREAM_BUFFER_SIZE;
+
+	while(size - s->len < len)
+		size *= 2;
+
+	char *const buf = realloc(s->buf, size);
+
+	if(buf == NULL)
+		error(EXIT_FAILURE, errno, "error allocating buffer");
+
+	s->buf = buf;
+	s->size = size;
+}
+
+/* Hold BUF back, passing on every segment it completes. The buffer only
+	grows to hold the longest segment, or all input when reversing it
+	whole */
+static void reverse_push(struct pipeline *const p, size_t const i,
+						 char const *const buf, size_t const len)
+{
+	struct stage *const s = &p->stage[i];
+	size_t const from = s->len;
+
+	stage_reserve(s, len);
+	memcpy(s->buf + s->len, buf, len);
+	s->len += len;
+
+	if(s->scan == NULL)
+		return;
+
+	char *const tail = reverse_segments(s->buf, s->buf + from,
+										s->buf + s->len, s->scan, s->reverse);
+	size_t const done = (size_t)(tail - s->buf);
+
+	if(done == 0)
+		return;
+
+	pipeline_push(p, i + 1, s->buf, done);
+	s->len -= done;
+	memmove(s->buf, tail, s->len);
+}
+
+static void reverse_finish(struct pipeline *const p, size_t const i)
+{
+	struct stage *const s = &p->stage[i];
+
+	s->reverse(s->buf, s->len);
+	pipeline_push(p, i + 1, s->buf, s->len);
+	s->len = 0;
+}
+
+/* Copy into the output buffer, passing it on whenever it fills */
+static void tokenize_emit(struct pipeline *const p, size_t const i,
+						  char const *buf, size_t len)
+{
+	struct stage *const s = &p->stage[i];
+
+	while(len != 0) {
+		if(s->len == s->size) {
+			pipeline_push(p, i + 1, s->buf, s->len);
+			s->len = 0;
+		}
+
+		size_t const room = s->size - s->len;
+		size_t const n = (room < len) ? room : len;
+
+		memcpy(s->buf + s->len, buf, n);
+		s->len += n;
+		buf += n;
+		len -= n;
+	}
+}
+
+/* A delimiter is only written once more input arrives after a full
+	token */
+static void tokenize_push(struct pipeline *const p, size_t const i,
+						  char const *buf, size_t len)
+{
+	struct stage *const s = &p->stage[i];
+
+	while(len != 0) {
+		if(s->filled == s->token_size) {
+			tokenize_emit(p, i, s->delim, s->delim_len);
+			s->filled = 0;
+		}
+
+		uintmax_t const room = s->token_size - s->filled;
+		size_t const n = (room < len) ? (size_t)room : len;
+
+		tokenize_emit(p, i, buf, n);
+		s->filled += n;
+		buf += n;
+		len -= n;
+	}
+}
+
+/* Pad only the final, partial token */
+static void tokenize_finish(struct pipeline *const p, size_t const i)
+{
+	static char pad[STREAM_BUFFER_SIZE];
+	struct stage *const s = &p->stage[i];
+
+	if(s->filled != 0 && s->filled != s->token_size) {
+		memset(pad, s->padding, sizeof(pad));
+
+		for(uintmax_t left = s->token_size - s->filled; left != 0;) {
+			size_t const n = (left < sizeof(pad))
+				? (size_t)left : sizeof(pad);
+			tokenize_emit(p, i, pad, n);
+			left -= n;
+		}
+	}
+
+	pipeline_push(p, i + 1, s->buf, s->len);
+	s->len = 0;
+	s->filled = 0;
+}
+
+/* Run BUF through the stages from I on. Substitutions work in place, a
+	stateful stage takes over and passes on its own buffer */
+static void pipeline_push(struct pipeline *const p, size_t i, char *const buf,
+						  size_t const len)
+{
+	if(len == 0)
+		return;
+
+	for(; i < p->count; ++i) {
+		struct stage *const s = &p->stage[i];
+
+		switch(s->type) {
+			case stage_subst:
+				s->fn(buf, len, &s->key);
+				break;
+			case stage_reverse:
+				reverse_push(p, i, buf, len);
+				return;
+			case stage_tokenize:
+				tokenize_push(p, i, buf, len);
+				return;
+		}
+	}
+
+	write_all(STDOUT_FILENO, buf, len);
+}
+
+/* End of one input, flush every stage in order so the output of one is
+	seen by the next before it flushes */
+static void pipeline_finish(struct pipeline *const p)
+{
+	for(size_t i = 0; i < p->count; ++i) {
+		if(p->stage[i].type == stage_reverse)
+			reverse_finish(p, i);
+		else if(p->stage[i].type == stage_tokenize)
+			tokenize_finish(p, i);
+	}
+}
+
+static void pipeline_file(struct pipeline *const p, char const *const path)
+{
+	static char buf[STREAM_BUFFER_SIZE];
+
+	int const fd = stream_open(path);
+	size_t n;
+
+	while((n = read_full(fd, buf, sizeof(buf), path)) != 0)
+		pipeline_push(p, 0, buf, n);
+
+	stream_close(fd, path);
+	pipeline_finish(p);
+}
+
+static void pipeline_free(struct pipeline *const p)
+{
+	for(size_t i = 0; i < p->count; ++i)
+		free(p->stage[i].buf);
+
+	free(p->stage);
+	free(p->spec);
+}
+
+int main(int const argc, char *const *const argv)
+{
+	quiet = false;
+	bool read_files = false;
+
+	static char const *const default_strings_list[] = {NULL};
+	static char const *const default_files_list[] = {"-", NULL};
+	char const *const *strings_list;
+
+	int c;
+
+	while((c = getopt_long(argc, argv, "fhI:q", long_opts, NULL)) != -1) {
+		switch(c) {
+			case 'f':
+				read_files = true;
+				break;
+			case 'h':
+				usage(EXIT_SUCCESS, argv[0]);
+				break;
+			case 'I':
+				cpu_select(optarg);
+				break;
+			case 'q':
+				quiet = true;
+				break;
+			default:
+				usage(EXIT_FAILURE, argv[0]);
+		}
+	}
+
+	char const *const spec = argv[optind++];
+
+	if(spec == NULL)
+		error(EXIT_FAILURE, 0, "first argument must be the spec, try '--help'");
+
+	struct pipeline pipeline;
+
+	pipeline_parse(&pipeline, spec);
+
+	if(read_files) {
+		strings_list = (optind < argc
+						? (char const *const *) &argv[optind]
+						: default_files_list);
+
+		for(size_t i = 0; strings_list[i]; ++i)
+			pipeline_file(&pipeline, strings_list[i]);
+
+		pipeline_free(&pipeline);
+		return EXIT_SUCCESS;
+	}
+
+	strings_list = (optind < argc
+					? (char const *const *) &argv[optind]
+					: default_strings_list);
+
+	for(size_t i = 0; strings_list[i]; ++i) {
+		char *const string = strdup(strings_list[i]);
+
+		if(string == NULL)
+			error(EXIT_FAILURE, errno, "error allocating string");
+
+		pipeline_push(&pipeline, 0, string, strlen(string));
+		pipeline_finish(&pipeline);
+		write_all(STDOUT_FILENO, "\n", 1);
+		free(string);
+	}
+
+	pipeline_free(&pipeline);
+	return EXIT_SUCCESS;
+}
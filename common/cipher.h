@@ -0,0 +1,174 @@
+/* cipher -- per-character reference ciphers and the tables built from them */
+
+#ifndef COMMON_CIPHER_H
+#define COMMON_CIPHER_H
+
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "table.h"
+
+/* Standard 26-character alphabet */
+#define ALPHABET_SIZE 26
+
+/* Standard base-10 numeric system */
+#define NUMERIC_SIZE 10
+
+/* Least common multiple of alphabet and numeric size */
+#define LCM_ALPHA_NUM 130
+
+/* Rotate letters, and digits when NUMBERS is set. The rotation is
+	reduced first so no count of ROTATIONS can wrap.
+	Assumes contiguous character encoding from a-z A-Z */
+static inline char rotate_char(char const ch, uintmax_t const rotations,
+							   bool const numbers)
+{
+	uintmax_t rot_ch;
+	uintmax_t mod = ALPHABET_SIZE;
+
+	if(ch >= 'a' && ch <= 'z') {
+		rot_ch = 'a';
+	} else if(ch >= 'A' && ch <= 'Z') {
+		rot_ch = 'A';
+	} else if(numbers && (ch >= '0' && ch <= '9')) {
+		rot_ch = '0';
+		mod = NUMERIC_SIZE;
+	} else {
+		return ch;
+	}
+
+	return (char)(rot_ch + (((uintmax_t)ch - rot_ch + rotations % mod) % mod));
+}
+
+/* Assumes contiguous character encoding from a-z A-Z */
+static inline char exchange_char(char const ch, char const *const key)
+{
+	if(ch >= 'a' && ch <= 'z')
+		return key[ch - 'a'];
+	else if(ch >= 'A' && ch <= 'Z')
+		return (char)toupper(key[ch - 'A']);
+
+	return ch;
+}
+
+/* Invert KEY into INVERSE, letters compared without case. Returns false
+	when two letters of KEY are the same and there is no inverse */
+static inline bool invert_key(char *const inverse, char const *const key)
+{
+	memset(inverse, 0, ALPHABET_SIZE + 1);
+
+	for(size_t i = 0; i < ALPHABET_SIZE; ++i) {
+		size_t const c = (size_t)(tolower((unsigned char)key[i]) - 'a');
+
+		if(inverse[c] != '\0')
+			return false;
+
+		inverse[c] = (char)('a' + i);
+	}
+
+	return true;
+}
+
+__attribute__((const))
+static inline intmax_t gcd(intmax_t const a, intmax_t const b)
+{
+	return (b != 0) ? gcd(b, a % b) : a;
+}
+
+/* Calculate modular multiplicitive inverse,
+	source: Rosetta Code */
+__attribute__((const))
+static inline intmax_t mod_inverse(intmax_t a, intmax_t b)
+{
+	if(b == 1)
+		return 1;
+
+	intmax_t const b0 = b;
+	intmax_t t, q;
+	intmax_t x0 = 0, x1 = 1;
+
+	while(a > 1) {
+		q = a / b;
+		t = b;
+		b = a % b;
+		a = t;
+		t = x0;
+		x0 = x1 - q * x0;
+		x1 = t;
+	}
+
+	if(x1 < 0)
+		x1 += b0;
+
+	return x1;
+}
+
+/* Assumes contiguous character encoding from a-z A-Z */
+static inline char encrypt_char(char const ch, intmax_t const a,
+								intmax_t const b)
+{
+	intmax_t enc;
+
+	if(ch >= 'a' && ch <= 'z')
+		enc = 'a';
+	else if(ch >= 'A' && ch <= 'Z')
+		enc = 'A';
+	else
+		return ch;
+
+	return (char)(enc + ((a * ((intmax_t)ch - enc) + b) % ALPHABET_SIZE));
+}
+
+static inline char decrypt_char(char const ch, intmax_t const b,
+								intmax_t const mod_inv)
+{
+	intmax_t dec;
+
+	if(ch >= 'a' && ch <= 'z')
+		dec = 'a';
+	else if(ch >= 'A' && ch <= 'Z')
+		dec = 'A';
+	else
+		return ch;
+
+	return (char)(dec + (mod_inv * (ALPHABET_SIZE + ch - dec
+			- b % ALPHABET_SIZE) % ALPHABET_SIZE));
+}
+
+/* Compile each cipher into a table once, the functions above stay the
+	reference */
+static inline void rotate_table(unsigned char *const table,
+								uintmax_t const rotations, bool const numbers)
+{
+	for(size_t i = 0; i < TABLE_SIZE; ++i)
+		table[i] = (unsigned char)rotate_char((char)i, rotations, numbers);
+}
+
+static inline void exchange_table(unsigned char *const table,
+								  char const *const key)
+{
+	for(size_t i = 0; i < TABLE_SIZE; ++i)
+		table[i] = (unsigned char)exchange_char((char)i, key);
+}
+
+/* A and B are reduced first so encrypt_char cannot overflow */
+static inline void affine_encrypt_table(unsigned char *const table,
+										intmax_t const a, intmax_t const b)
+{
+	for(size_t i = 0; i < TABLE_SIZE; ++i) {
+		table[i] = (unsigned char)encrypt_char((char)i, a % ALPHABET_SIZE,
+											   b % ALPHABET_SIZE);
+	}
+}
+
+static inline void affine_decrypt_table(unsigned char *const table,
+										intmax_t const b,
+										intmax_t const mod_inv)
+{
+	for(size_t i = 0; i < TABLE_SIZE; ++i)
+		table[i] = (unsigned char)decrypt_char((char)i, b, mod_inv);
+}
+
+#endif /* COMMON_CIPHER_H */
@@ -0,0 +1,92 @@
+/* cpu -- runtime selection of vector kernel tiers */
+
+#ifndef COMMON_CPU_H
+#define COMMON_CPU_H
+
+#include <error.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_X86 1
+#include <immintrin.h>
+#endif
+
+/* Environment variable forcing a tier, overridden by '--isa' */
+#define CPU_ENV "CIPHER_ISA"
+
+/* Kernel tiers, ordered from narrowest to widest */
+enum cpu_tier {
+	tier_scalar, tier_sse2, tier_avx2, tier_avx512, tier_auto
+};
+
+static char const *const cpu_tier_names[] = {
+	[tier_scalar] = "scalar",
+	[tier_sse2] = "sse2",
+	[tier_avx2] = "avx2",
+	[tier_avx512] = "avx512"
+};
+
+/* Tier used by every kernel, picked on first use */
+static enum cpu_tier cpu_choice = tier_auto;
+
+/* Widest tier this CPU supports */
+static inline enum cpu_tier cpu_detect(void)
+{
+#ifdef CPU_X86
+	__builtin_cpu_init();
+
+	if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+		return tier_avx512;
+	if(__builtin_cpu_supports("avx2"))
+		return tier_avx2;
+	if(__builtin_cpu_supports("sse2"))
+		return tier_sse2;
+#endif
+	return tier_scalar;
+}
+
+/* Force a tier by name, exits if it is unknown or unsupported */
+static inline void cpu_select(char const *const name)
+{
+	for(size_t i = 0; i < tier_auto; ++i) {
+		if(strcmp(name, cpu_tier_names[i]) != 0)
+			continue;
+
+		if(i > cpu_detect())
+			error(EXIT_FAILURE, 0, "'%s' is not supported by this CPU", name);
+
+		cpu_choice = (enum cpu_tier)i;
+		return;
+	}
+
+	error(EXIT_FAILURE, 0, "unknown tier '%s', expected scalar, sse2, "
+						   "avx2 or avx512", name);
+}
+
+static inline enum cpu_tier cpu_tier(void)
+{
+	if(cpu_choice == tier_auto) {
+		char const *const env = getenv(CPU_ENV);
+
+		if(env != NULL && *env != '\0')
+			cpu_select(env);
+		else
+			cpu_choice = cpu_detect();
+	}
+
+	return cpu_choice;
+}
+
+/* The 128-bit tier only guarantees SSE2, shuffle kernels also need SSSE3 */
+static inline bool cpu_has_ssse3(void)
+{
+#ifdef CPU_X86
+	return __builtin_cpu_supports("ssse3");
+#else
+	return false;
+#endif
+}
+
+#endif /* COMMON_CPU_H */
@@ -0,0 +1,106 @@
+/* crack -- hold ciphertext in memory and rank candidate keys */
+
+#ifndef COMMON_CRACK_H
+#define COMMON_CRACK_H
+
+#include <errno.h>
+#include <error.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "stream.h"
+
+/* One input, read once for scoring and again for decryption */
+struct crack_input {
+	char const *path;
+	char *buf;
+	size_t len;
+	bool mapped;
+};
+
+/* Regular files get a private writable mapping, which the decryption
+	may overwrite without touching the file; anything else is read */
+static inline void crack_load(struct crack_input *const in,
+							  char const *const path)
+{
+	int const fd = stream_open(path);
+	struct stat st;
+
+	in->path = path;
+	in->buf = NULL;
+	in->len = 0;
+	in->mapped = false;
+
+	if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0
+	   && lseek(fd, 0, SEEK_CUR) == 0) {
+		in->len = (size_t)st.st_size;
+		in->buf = mmap(NULL, in->len, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+					   fd, 0);
+
+		if(in->buf != MAP_FAILED) {
+			in->mapped = true;
+			stream_close(fd, path);
+			return;
+		}
+
+		in->buf = NULL;
+		in->len = 0;
+	}
+
+	size_t size = 0;
+	size_t n;
+
+	do {
+		if(size - in->len < STREAM_BUFFER_SIZE) {
+			size = size ? size * 2 : STREAM_BUFFER_SIZE;
+
+			char *const buf = realloc(in->buf, size);
+
+			if(buf == NULL)
+				error(EXIT_FAILURE, errno, "error allocating buffer");
+
+			in->buf = buf;
+		}
+
+		n = read_full(fd, in->buf + in->len, STREAM_BUFFER_SIZE, path);
+		in->len += n;
+	} while(n == STREAM_BUFFER_SIZE);
+
+	stream_close(fd, path);
+}
+
+static inline void crack_free(struct crack_input *const in)
+{
+	if(in->mapped)
+		munmap(in->buf, in->len);
+	else
+		free(in->buf);
+}
+
+/* Candidate key and its score, lower is better */
+struct crack_rank {
+	uintmax_t key;
+	double score;
+};
+
+static inline int crack_rank_cmp(void const *const a, void const *const b)
+{
+	struct crack_rank const *const x = a;
+	struct crack_rank const *const y = b;
+
+	if(x->score != y->score)
+		return x->score < y->score ? -1 : 1;
+
+	return (x->key > y->key) - (x->key < y->key);
+}
+
+static inline void crack_sort(struct crack_rank *const ranks, size_t const n)
+{
+	qsort(ranks, n, sizeof(*ranks), crack_rank_cmp);
+}
+
+#endif /* COMMON_CRACK_H */
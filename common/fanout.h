@@ -0,0 +1,165 @@
+/* fanout -- run every input block through several keys */
+
+#ifndef COMMON_FANOUT_H
+#define COMMON_FANOUT_H
+
+#include <errno.h>
+#include <error.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "stream.h"
+
+/* Input block read at a time, and the size of each key's output buffer */
+#define FANOUT_BUFFER_SIZE (1 << 16)
+
+/* Slice of the input block handed to every key in turn, small enough to
+	stay in L1 across all of them */
+#define FANOUT_SLICE_SIZE (1 << 13)
+
+/* One transform, many keys and as many outputs */
+struct fanout {
+	stream_fn *fn;
+	size_t count;
+
+	void const **arg;
+	int *fd;
+	bool *owned;
+	char *buf;
+};
+
+static inline void fanout_init(struct fanout *const f, stream_fn *const fn,
+							   size_t const count)
+{
+	f->fn = fn;
+	f->count = count;
+	f->arg = calloc(count, sizeof(*f->arg));
+	f->fd = calloc(count, sizeof(*f->fd));
+	f->owned = calloc(count, sizeof(*f->owned));
+	f->buf = malloc(count * FANOUT_BUFFER_SIZE);
+
+	if(f->arg == NULL || f->fd == NULL || f->owned == NULL || f->buf == NULL)
+		error(EXIT_FAILURE, errno, "error allocating output buffers");
+}
+
+/* Destination of key I of COUNT in SPEC: either a template where "{}"
+	stands for the key's LABEL, or a comma-separated list with one entry
+	per key. The result is allocated */
+static inline char *fanout_dest(char const *const spec, size_t const i,
+								size_t const count, char const *const label)
+{
+	char const *const mark = strstr(spec, "{}");
+	char *dest;
+
+	if(mark != NULL) {
+		size_t const head = (size_t)(mark - spec);
+		size_t const tail = strlen(mark + 2);
+		size_t const len = strlen(label);
+
+		if((dest = malloc(head + len + tail + 1)) == NULL)
+			error(EXIT_FAILURE, errno, "error allocating buffer");
+
+		memcpy(dest, spec, head);
+		memcpy(dest + head, label, len);
+		memcpy(dest + head + len, mark + 2, tail + 1);
+		return dest;
+	}
+
+	char const *p = spec;
+
+	for(size_t n = 0; n < i; ++n) {
+		if((p = strchr(p, ',')) == NULL)
+			break;
+		++p;
+	}
+
+	char const *const end = p ? strchr(p, ',') : NULL;
+
+	if(p == NULL || (i + 1 == count) != (end == NULL))
+		error(EXIT_FAILURE, 0, "'%s' must have one output per key, "
+			  "or contain {}", spec);
+
+	size_t const len = end ? (size_t)(end - p) : strlen(p);
+
+	if((dest = malloc(len + 1)) == NULL)
+		error(EXIT_FAILURE, errno, "error allocating buffer");
+
+	memcpy(dest, p, len);
+	dest[len] = '\0';
+	return dest;
+}
+
+/* Send key I's output to DEST: "&N" is an open file descriptor, anything
+	else a file to create */
+static inline void fanout_add(struct fanout *const f, size_t const i,
+							  void const *const arg, char const *const dest)
+{
+	f->arg[i] = arg;
+
+	if(dest[0] == '&') {
+		char *end;
+		uintmax_t const fd = strtoumax(dest + 1, &end, 10);
+
+		if(end == dest + 1 || *end != '\0' || fd > INT_MAX
+		   || fcntl((int)fd, F_GETFD) < 0)
+			error(EXIT_FAILURE, errno, "%s: bad file descriptor", dest);
+
+		f->fd[i] = (int)fd;
+		f->owned[i] = false;
+		return;
+	}
+
+	if((f->fd[i] = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+		error(EXIT_FAILURE, errno, "%s", dest);
+
+	f->owned[i] = true;
+}
+
+/* Read PATH once, every slice goes through all keys before the next */
+static inline void fanout_file(struct fanout const *const f,
+							   char const *const path)
+{
+	static char in[FANOUT_BUFFER_SIZE];
+
+	int const fd = stream_open(path);
+	size_t n;
+
+	while((n = read_full(fd, in, sizeof(in), path)) != 0) {
+		for(size_t off = 0; off < n; off += FANOUT_SLICE_SIZE) {
+			size_t const len = n - off < FANOUT_SLICE_SIZE
+				? n - off : FANOUT_SLICE_SIZE;
+
+			for(size_t k = 0; k < f->count; ++k) {
+				char *const out = f->buf + k * FANOUT_BUFFER_SIZE + off;
+
+				memcpy(out, in + off, len);
+				f->fn(out, len, f->arg[k]);
+			}
+		}
+
+		for(size_t k = 0; k < f->count; ++k)
+			write_all(f->fd[k], f->buf + k * FANOUT_BUFFER_SIZE, n);
+	}
+
+	stream_close(fd, path);
+}
+
+static inline void fanout_close(struct fanout *const f)
+{
+	for(size_t k = 0; k < f->count; ++k) {
+		if(f->owned[k] && close(f->fd[k]) != 0)
+			error(EXIT_FAILURE, errno, "error closing output");
+	}
+
+	free(f->arg);
+	free(f->fd);
+	free(f->owned);
+	free(f->buf);
+}
+
+#endif /* COMMON_FANOUT_H */
@@ -0,0 +1,104 @@
+/* gather -- batched scatter/gather output through writev */
+
+#ifndef COMMON_GATHER_H
+#define COMMON_GATHER_H
+
+#include <errno.h>
+#include <error.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "stream.h"
+
+/* Entries per writev call, the Linux IOV_MAX */
+#define GATHER_ENTRIES 1024
+
+/* Slices shorter than this are cheaper to copy than to reference */
+#define GATHER_COPY_MAX 64
+
+/* Pending output, entries reference the caller's buffers until
+	gather_flush, so those must stay valid until then */
+struct gather {
+	int fd;
+	int count;
+	struct iovec iov[GATHER_ENTRIES];
+
+	/* Short slices are copied here and merged into one entry */
+	size_t staged;
+	char stage[STREAM_BUFFER_SIZE];
+};
+
+static inline void gather_flush(struct gather *const g)
+{
+	struct iovec *iov = g->iov;
+	int count = g->count;
+
+	while(count != 0) {
+		ssize_t n = writev(g->fd, iov, count);
+
+		if(n < 0) {
+			if(errno == EINTR)
+				continue;
+			error(EXIT_FAILURE, errno, "write error");
+		}
+
+		while(count != 0 && (size_t)n >= iov->iov_len) {
+			n -= (ssize_t)iov->iov_len;
+			++iov;
+			--count;
+		}
+
+		if(count != 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= (size_t)n;
+		}
+	}
+
+	g->count = 0;
+	g->staged = 0;
+}
+
+static inline void gather_add(struct gather *const g, char const *const buf,
+							  size_t const len)
+{
+	if(len == 0)
+		return;
+
+	if(len >= GATHER_COPY_MAX) {
+		if(g->count == GATHER_ENTRIES)
+			gather_flush(g);
+
+		g->iov[g->count++] = (struct iovec) {
+			.iov_base = (void *)buf,
+			.iov_len = len
+		};
+		return;
+	}
+
+	if(g->staged + len > sizeof(g->stage) || g->count == GATHER_ENTRIES)
+		gather_flush(g);
+
+	char *const dst = g->stage + g->staged;
+
+	memcpy(dst, buf, len);
+	g->staged += len;
+
+	if(g->count != 0) {
+		struct iovec *const last = &g->iov[g->count - 1];
+
+		if((char *)last->iov_base + last->iov_len == dst) {
+			last->iov_len += len;
+			return;
+		}
+	}
+
+	g->iov[g->count++] = (struct iovec) {
+		.iov_base = dst,
+		.iov_len = len
+	};
+}
+
+#endif /* COMMON_GATHER_H */
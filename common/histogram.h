@@ -0,0 +1,187 @@
+/* histogram -- byte histograms and frequency scoring */
+
+#ifndef COMMON_HISTOGRAM_H
+#define COMMON_HISTOGRAM_H
+
+#include <errno.h>
+#include <error.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "table.h"
+
+/* Sub-tables counted in turn, so runs of one byte value do not queue up
+	on the store of a single counter */
+#define HISTOGRAM_LANES 4
+
+/* Bytes counted before the 32-bit sub-tables are folded */
+#define HISTOGRAM_CHUNK ((size_t)1 << 30)
+
+/* Smallest share worth a thread of its own */
+#define HISTOGRAM_SLICE_MIN ((size_t)1 << 20)
+
+#define HISTOGRAM_LETTERS 26
+#define HISTOGRAM_DIGITS 10
+
+struct histogram {
+	uint64_t count[TABLE_SIZE];
+};
+
+/* Add the bytes of BUF to H, eight at a time from one 64-bit load */
+static inline void histogram_block(struct histogram *const h,
+								   char const *buf, size_t len)
+{
+	static _Thread_local uint32_t sub[HISTOGRAM_LANES][TABLE_SIZE];
+
+	while(len != 0) {
+		size_t const n = len < HISTOGRAM_CHUNK ? len : HISTOGRAM_CHUNK;
+		size_t i = 0;
+
+		memset(sub, 0, sizeof(sub));
+
+		for(; i + 8 <= n; i += 8) {
+			uint64_t w;
+			memcpy(&w, buf + i, sizeof(w));
+
+			++sub[0][w & 0xff];
+			++sub[1][(w >> 8) & 0xff];
+			++sub[2][(w >> 16) & 0xff];
+			++sub[3][(w >> 24) & 0xff];
+			++sub[0][(w >> 32) & 0xff];
+			++sub[1][(w >> 40) & 0xff];
+			++sub[2][(w >> 48) & 0xff];
+			++sub[3][w >> 56];
+		}
+
+		for(; i < n; ++i)
+			++sub[0][(unsigned char)buf[i]];
+
+		for(size_t c = 0; c < TABLE_SIZE; ++c) {
+			for(size_t l = 0; l < HISTOGRAM_LANES; ++l)
+				h->count[c] += sub[l][c];
+		}
+
+		buf += n;
+		len -= n;
+	}
+}
+
+/* One thread's share of the buffer */
+struct histogram_slice {
+	pthread_t thread;
+	char const *buf;
+	size_t len;
+	struct histogram h;
+};
+
+static inline void *histogram_worker(void *const data)
+{
+	struct histogram_slice *const slice = data;
+	histogram_block(&slice->h, slice->buf, slice->len);
+	return NULL;
+}
+
+/* Same as histogram_block, split over THREADS threads */
+static inline void histogram_parallel(struct histogram *const h,
+									  char const *const buf,
+									  size_t const len, size_t threads)
+{
+	if(threads > len / HISTOGRAM_SLICE_MIN + 1)
+		threads = len / HISTOGRAM_SLICE_MIN + 1;
+
+	if(threads <= 1) {
+		histogram_block(h, buf, len);
+		return;
+	}
+
+	struct histogram_slice *const slices = calloc(threads, sizeof(*slices));
+
+	if(slices == NULL)
+		error(EXIT_FAILURE, errno, "error allocating threads");
+
+	for(size_t i = 0; i < threads; ++i) {
+		size_t const begin = len / threads * i;
+		size_t const end = (i + 1 == threads) ? len : len / threads * (i + 1);
+
+		slices[i].buf = buf + begin;
+		slices[i].len = end - begin;
+	}
+
+	int err;
+
+	for(size_t i = 1; i < threads; ++i) {
+		if((err = pthread_create(&slices[i].thread, NULL, histogram_worker,
+								 &slices[i])))
+			error(EXIT_FAILURE, err, "error creating threads");
+	}
+
+	histogram_worker(&slices[0]);
+
+	for(size_t i = 0; i < threads; ++i) {
+		if(i != 0)
+			pthread_join(slices[i].thread, NULL);
+
+		for(size_t c = 0; c < TABLE_SIZE; ++c)
+			h->count[c] += slices[i].h.count[c];
+	}
+
+	free(slices);
+}
+
+/* Case-folded counts of a-z, assumes contiguous a-z A-Z */
+static inline void histogram_letters(struct histogram const *const h,
+									 uint64_t *const letters)
+{
+	for(size_t i = 0; i < HISTOGRAM_LETTERS; ++i)
+		letters[i] = h->count['a' + i] + h->count['A' + i];
+}
+
+static inline void histogram_digits(struct histogram const *const h,
+									uint64_t *const digits)
+{
+	for(size_t i = 0; i < HISTOGRAM_DIGITS; ++i)
+		digits[i] = h->count['0' + i];
+}
+
+/* Relative frequency of a-z in English text */
+static double const english_freq[HISTOGRAM_LETTERS] = {
+	0.08167, 0.01492, 0.02782, 0.04253, 0.12702, 0.02228, 0.02015,
+	0.06094, 0.06966, 0.00153, 0.00772, 0.04025, 0.02406, 0.06749,
+	0.07507, 0.01929, 0.00095, 0.05987, 0.06327, 0.09056, 0.02758,
+	0.00978, 0.02360, 0.00150, 0.01974, 0.00074
+};
+
+/* Rough frequency of 0-9 in running text: years, counts and round
+	numbers favour the small digits */
+static double const digit_freq[HISTOGRAM_DIGITS] = {
+	0.170, 0.210, 0.140, 0.090, 0.080, 0.080, 0.060, 0.060, 0.060, 0.050
+};
+
+/* Chi-squared distance between the expected frequencies FREQ and the
+	counts of N symbols as seen through a permutation: plaintext symbol j
+	is counted at COUNT[(MUL * j + ADD) % N]. Lower is closer */
+static inline double histogram_chi(uint64_t const *const count,
+								   double const *const freq, size_t const n,
+								   size_t const mul, size_t const add)
+{
+	uint64_t total = 0;
+	double chi = 0;
+
+	for(size_t j = 0; j < n; ++j)
+		total += count[j];
+
+	if(total == 0)
+		return 0;
+
+	for(size_t j = 0; j < n; ++j) {
+		double const expected = (double)total * freq[j];
+		double const d = (double)count[(mul * j + add) % n] - expected;
+		chi += d * d / expected;
+	}
+
+	return chi;
+}
+
+#endif /* COMMON_HISTOGRAM_H */
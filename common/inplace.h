@@ -0,0 +1,111 @@
+/* inplace -- transform files in place through a shared mapping */
+
+#ifndef COMMON_INPLACE_H
+#define COMMON_INPLACE_H
+
+#include <errno.h>
+#include <error.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "stream.h"
+
+/* One thread's share of the mapping */
+struct inplace_slice {
+	pthread_t thread;
+	char *buf;
+	size_t len;
+	stream_fn *fn;
+	void const *arg;
+};
+
+static inline void *inplace_worker(void *const data)
+{
+	struct inplace_slice const *const slice = data;
+	slice->fn(slice->buf, slice->len, slice->arg);
+	return NULL;
+}
+
+/* Map PATH read-write and transform it on THREADS threads, the transform
+	must not depend on the position of a byte in the file */
+static inline void inplace_file(char const *const path, stream_fn *const fn,
+								void const *const arg, size_t threads)
+{
+	int const fd = open(path, O_RDWR);
+
+	if(fd < 0)
+		error(EXIT_FAILURE, errno, "%s", path);
+
+	struct stat st;
+
+	if(fstat(fd, &st) != 0)
+		error(EXIT_FAILURE, errno, "%s", path);
+
+	if(!S_ISREG(st.st_mode))
+		error(EXIT_FAILURE, 0, "%s: not a regular file", path);
+
+	size_t const len = (size_t)st.st_size;
+
+	if(len == 0) {
+		close(fd);
+		return;
+	}
+
+	char *const map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED,
+						   fd, 0);
+
+	if(map == MAP_FAILED)
+		error(EXIT_FAILURE, errno, "%s", path);
+
+	(void)madvise(map, len, MADV_SEQUENTIAL);
+	(void)madvise(map, len, MADV_WILLNEED);
+
+	if(threads < 1)
+		threads = 1;
+	if(threads > len)
+		threads = len;
+
+	struct inplace_slice *const slices = malloc(threads * sizeof(*slices));
+
+	if(slices == NULL)
+		error(EXIT_FAILURE, errno, "error allocating threads");
+
+	for(size_t i = 0; i < threads; ++i) {
+		size_t const begin = len / threads * i;
+		size_t const end = (i + 1 == threads) ? len : len / threads * (i + 1);
+
+		slices[i] = (struct inplace_slice) {
+			.buf = map + begin,
+			.len = end - begin,
+			.fn = fn,
+			.arg = arg
+		};
+	}
+
+	int err;
+
+	for(size_t i = 1; i < threads; ++i) {
+		if((err = pthread_create(&slices[i].thread, NULL, inplace_worker,
+								 &slices[i])))
+			error(EXIT_FAILURE, err, "error creating threads");
+	}
+
+	inplace_worker(&slices[0]);
+
+	for(size_t i = 1; i < threads; ++i)
+		pthread_join(slices[i].thread, NULL);
+
+	free(slices);
+
+	if(msync(map, len, MS_SYNC) != 0)
+		error(EXIT_FAILURE, errno, "%s", path);
+
+	if(munmap(map, len) != 0 || close(fd) != 0)
+		error(EXIT_FAILURE, errno, "%s", path);
+}
+
+#endif /* COMMON_INPLACE_H */
@@ -0,0 +1,214 @@
+/* parallel -- order-preserving multi-threaded block streaming */
+
+#ifndef COMMON_PARALLEL_H
+#define COMMON_PARALLEL_H
+
+#include <errno.h>
+#include <error.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "stream.h"
+
+/* Size of the chunks handed to workers */
+#define PARALLEL_CHUNK_SIZE (1 << 20)
+
+/* Upper bound on '--threads' */
+#define PARALLEL_MAX_THREADS 1024
+
+enum slot_state {
+	slot_free, slot_full, slot_done
+};
+
+/* One chunk in flight, chunk number seq lives in slots[seq % nslots] */
+struct parallel_slot {
+	char *buf;
+	size_t len;
+	enum slot_state state;
+};
+
+/* Reorder buffer shared by the reader, the workers and the writer */
+struct parallel_ring {
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+
+	struct parallel_slot *slots;
+	size_t nslots;
+
+	/* Next chunk to read, transform and write */
+	size_t read_seq;
+	size_t work_seq;
+	size_t write_seq;
+	bool eof;
+
+	stream_fn *fn;
+	void const *arg;
+};
+
+static inline void *parallel_worker(void *const data)
+{
+	struct parallel_ring *const ring = data;
+
+	pthread_mutex_lock(&ring->lock);
+
+	for(;;) {
+		while(ring->work_seq == ring->read_seq && !ring->eof)
+			pthread_cond_wait(&ring->changed, &ring->lock);
+
+		if(ring->work_seq == ring->read_seq)
+			break;
+
+		struct parallel_slot *const slot =
+			&ring->slots[ring->work_seq++ % ring->nslots];
+
+		pthread_mutex_unlock(&ring->lock);
+		ring->fn(slot->buf, slot->len, ring->arg);
+		pthread_mutex_lock(&ring->lock);
+
+		slot->state = slot_done;
+		pthread_cond_broadcast(&ring->changed);
+	}
+
+	pthread_mutex_unlock(&ring->lock);
+	return NULL;
+}
+
+/* Write chunks strictly in input order */
+static inline void *parallel_writer(void *const data)
+{
+	struct parallel_ring *const ring = data;
+
+	pthread_mutex_lock(&ring->lock);
+
+	for(;;) {
+		struct parallel_slot *const slot =
+			&ring->slots[ring->write_seq % ring->nslots];
+
+		while(slot->state != slot_done
+			  && !(ring->eof && ring->write_seq == ring->read_seq))
+			pthread_cond_wait(&ring->changed, &ring->lock);
+
+		if(slot->state != slot_done)
+			break;
+
+		pthread_mutex_unlock(&ring->lock);
+		write_all(STDOUT_FILENO, slot->buf, slot->len);
+		pthread_mutex_lock(&ring->lock);
+
+		slot->state = slot_free;
+		ring->write_seq++;
+		pthread_cond_broadcast(&ring->changed);
+	}
+
+	pthread_mutex_unlock(&ring->lock);
+	return NULL;
+}
+
+/* Same as stream_file, transforming chunks on THREADS workers */
+static inline void parallel_file(char const *const path, stream_fn *const fn,
+								 void const *const arg, size_t const threads)
+{
+	if(threads <= 1) {
+		stream_file(path, fn, arg);
+		return;
+	}
+
+	struct parallel_ring ring = {
+		.nslots = 2 * threads,
+		.fn = fn,
+		.arg = arg
+	};
+
+	pthread_mutex_init(&ring.lock, NULL);
+	pthread_cond_init(&ring.changed, NULL);
+
+	ring.slots = calloc(ring.nslots, sizeof(*ring.slots));
+
+	if(ring.slots == NULL)
+		error(EXIT_FAILURE, errno, "error allocating chunks");
+
+	for(size_t i = 0; i < ring.nslots; ++i) {
+		ring.slots[i].buf = malloc(PARALLEL_CHUNK_SIZE);
+		if(ring.slots[i].buf == NULL)
+			error(EXIT_FAILURE, errno, "error allocating chunks");
+	}
+
+	pthread_t *const workers = malloc((threads + 1) * sizeof(*workers));
+
+	if(workers == NULL)
+		error(EXIT_FAILURE, errno, "error allocating threads");
+
+	int err;
+
+	for(size_t i = 0; i < threads; ++i) {
+		if((err = pthread_create(&workers[i], NULL, parallel_worker, &ring)))
+			error(EXIT_FAILURE, err, "error creating threads");
+	}
+
+	if((err = pthread_create(&workers[threads], NULL, parallel_writer, &ring)))
+		error(EXIT_FAILURE, err, "error creating threads");
+
+	int const fd = stream_open(path);
+
+	for(;;) {
+		struct parallel_slot *const slot =
+			&ring.slots[ring.read_seq % ring.nslots];
+
+		pthread_mutex_lock(&ring.lock);
+		while(slot->state != slot_free)
+			pthread_cond_wait(&ring.changed, &ring.lock);
+		pthread_mutex_unlock(&ring.lock);
+
+		size_t const len = read_full(fd, slot->buf, PARALLEL_CHUNK_SIZE, path);
+
+		pthread_mutex_lock(&ring.lock);
+
+		if(len == 0) {
+			ring.eof = true;
+			pthread_cond_broadcast(&ring.changed);
+			pthread_mutex_unlock(&ring.lock);
+			break;
+		}
+
+		slot->len = len;
+		slot->state = slot_full;
+		ring.read_seq++;
+		pthread_cond_broadcast(&ring.changed);
+		pthread_mutex_unlock(&ring.lock);
+	}
+
+	stream_close(fd, path);
+
+	for(size_t i = 0; i <= threads; ++i)
+		pthread_join(workers[i], NULL);
+
+	for(size_t i = 0; i < ring.nslots; ++i)
+		free(ring.slots[i].buf);
+
+	free(workers);
+	free(ring.slots);
+	pthread_cond_destroy(&ring.changed);
+	pthread_mutex_destroy(&ring.lock);
+}
+
+/* Parse '--threads', zero means one per online processor */
+static inline size_t parallel_threads(char const *const arg)
+{
+	uintmax_t threads = strtoumax(arg, NULL, 10);
+
+	if(threads == 0) {
+		long const online = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = online > 0 ? (uintmax_t)online : 1;
+	}
+
+	if(threads > PARALLEL_MAX_THREADS)
+		error(EXIT_FAILURE, 0, "at most %d threads are supported",
+							   PARALLEL_MAX_THREADS);
+
+	return (size_t)threads;
+}
+
+#endif /* COMMON_PARALLEL_H */
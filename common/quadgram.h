@@ -0,0 +1,81 @@
+/* quadgram -- letter quadgram log-probability tables */
+
+#ifndef COMMON_QUADGRAM_H
+#define COMMON_QUADGRAM_H
+
+#include <ctype.h>
+#include <errno.h>
+#include <error.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define QUADGRAM_LETTERS 26
+
+/* One float per quadgram, indexed by the letters in base 26 */
+#define QUADGRAM_SIZE \
+	(QUADGRAM_LETTERS * QUADGRAM_LETTERS * QUADGRAM_LETTERS * QUADGRAM_LETTERS)
+
+static inline size_t quadgram_index(unsigned const a, unsigned const b,
+									unsigned const c, unsigned const d)
+{
+	return ((a * QUADGRAM_LETTERS + b) * QUADGRAM_LETTERS + c)
+		* QUADGRAM_LETTERS + d;
+}
+
+/* Load "ABCD COUNT" lines from PATH into a table of log10 probabilities,
+	quadgrams missing from the file get a floor well below any seen one */
+static inline float *quadgram_load(char const *const path)
+{
+	FILE *const f = fopen(path, "r");
+
+	if(f == NULL)
+		error(EXIT_FAILURE, errno, "%s", path);
+
+	double *const count = calloc(QUADGRAM_SIZE, sizeof(*count));
+	float *const table = malloc(QUADGRAM_SIZE * sizeof(*table));
+
+	if(count == NULL || table == NULL)
+		error(EXIT_FAILURE, errno, "error allocating quadgram table");
+
+	char gram[5];
+	uintmax_t n;
+	double total = 0;
+	size_t line = 0;
+	int r;
+
+	while((r = fscanf(f, "%4s %ju", gram, &n)) == 2) {
+		unsigned l[4];
+
+		++line;
+
+		for(size_t i = 0; i < 4; ++i) {
+			if(!isalpha((unsigned char)gram[i]))
+				error(EXIT_FAILURE, 0, "%s:%zu: invalid quadgram", path, line);
+			l[i] = (unsigned)(tolower((unsigned char)gram[i]) - 'a');
+		}
+
+		count[quadgram_index(l[0], l[1], l[2], l[3])] += (double)n;
+		total += (double)n;
+	}
+
+	if(r != EOF || ferror(f))
+		error(EXIT_FAILURE, 0, "%s:%zu: expected quadgram and count", path,
+			  line + 1);
+
+	if(total == 0)
+		error(EXIT_FAILURE, 0, "%s: no quadgrams", path);
+
+	fclose(f);
+
+	float const floor = (float)log10(0.01 / total);
+
+	for(size_t i = 0; i < QUADGRAM_SIZE; ++i)
+		table[i] = count[i] ? (float)log10(count[i] / total) : floor;
+
+	free(count);
+	return table;
+}
+
+#endif /* COMMON_QUADGRAM_H */
@@ -0,0 +1,194 @@
+/* reverse -- vector byte reversal kernels */
+
+#ifndef COMMON_REVERSE_H
+#define COMMON_REVERSE_H
+
+#include <stddef.h>
+
+#include "cpu.h"
+
+/* Copy SRC into DST back to front, the buffers must not overlap */
+typedef void reverse_fn(char *dst, char const *src, size_t len);
+
+/* Reverse BUF in place */
+typedef void reverse_inplace_fn(char *buf, size_t len);
+
+static inline void reverse_copy_scalar(char *const dst, char const *const src,
+									   size_t const len)
+{
+	for(size_t i = 0; i < len; ++i)
+		dst[i] = src[len - 1 - i];
+}
+
+static inline void reverse_inplace_scalar(char *const buf, size_t const len)
+{
+	for(size_t i = 0, j = len; i + 1 < j; ++i, --j) {
+		char const t = buf[i];
+		buf[i] = buf[j - 1];
+		buf[j - 1] = t;
+	}
+}
+
+#ifdef CPU_X86
+/* SSE2 has no byte shuffle: reverse dwords, then words, then bytes */
+__attribute__((target("sse2")))
+static inline __m128i reverse_vector_sse2(__m128i x)
+{
+	x = _mm_shuffle_epi32(x, _MM_SHUFFLE(0, 1, 2, 3));
+	x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+	x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+	return _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+}
+
+/* Reverse each 128-bit lane with vpshufb, then swap the lanes */
+__attribute__((target("avx2")))
+static inline __m256i reverse_vector_avx2(__m256i const x)
+{
+	__m256i const mask = _mm256_setr_epi8(
+		15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+		15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+	return _mm256_permute4x64_epi64(_mm256_shuffle_epi8(x, mask),
+									_MM_SHUFFLE(1, 0, 3, 2));
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static inline __m512i reverse_vector_avx512(__m512i const x)
+{
+	__m512i const mask = _mm512_broadcast_i32x4(_mm_setr_epi8(
+		15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0));
+	__m512i const r = _mm512_shuffle_epi8(x, mask);
+	return _mm512_shuffle_i64x2(r, r, _MM_SHUFFLE(0, 1, 2, 3));
+}
+
+/* Vectors are taken from the back of the source when copying,
+	and swapped pairwise from both ends when reversing in place */
+__attribute__((target("sse2")))
+static inline void reverse_copy_sse2(char *const dst, char const *const src,
+									 size_t const len)
+{
+	size_t i = 0;
+
+	for(; i + 16 <= len; i += 16) {
+		__m128i const x = _mm_loadu_si128(
+			(__m128i const *)(src + len - i - 16));
+		_mm_storeu_si128((__m128i *)(dst + i), reverse_vector_sse2(x));
+	}
+
+	reverse_copy_scalar(dst + i, src, len - i);
+}
+
+__attribute__((target("sse2")))
+static inline void reverse_inplace_sse2(char *const buf, size_t const len)
+{
+	size_t i = 0;
+
+	for(; 2 * (i + 16) <= len; i += 16) {
+		char *const front = buf + i;
+		char *const back = buf + len - i - 16;
+		__m128i const x = _mm_loadu_si128((__m128i const *)front);
+		__m128i const y = _mm_loadu_si128((__m128i const *)back);
+		_mm_storeu_si128((__m128i *)front, reverse_vector_sse2(y));
+		_mm_storeu_si128((__m128i *)back, reverse_vector_sse2(x));
+	}
+
+	reverse_inplace_scalar(buf + i, len - 2 * i);
+}
+
+__attribute__((target("avx2")))
+static inline void reverse_copy_avx2(char *const dst, char const *const src,
+									 size_t const len)
+{
+	size_t i = 0;
+
+	for(; i + 32 <= len; i += 32) {
+		__m256i const x = _mm256_loadu_si256(
+			(__m256i const *)(src + len - i - 32));
+		_mm256_storeu_si256((__m256i *)(dst + i), reverse_vector_avx2(x));
+	}
+
+	reverse_copy_scalar(dst + i, src, len - i);
+}
+
+__attribute__((target("avx2")))
+static inline void reverse_inplace_avx2(char *const buf, size_t const len)
+{
+	size_t i = 0;
+
+	for(; 2 * (i + 32) <= len; i += 32) {
+		char *const front = buf + i;
+		char *const back = buf + len - i - 32;
+		__m256i const x = _mm256_loadu_si256((__m256i const *)front);
+		__m256i const y = _mm256_loadu_si256((__m256i const *)back);
+		_mm256_storeu_si256((__m256i *)front, reverse_vector_avx2(y));
+		_mm256_storeu_si256((__m256i *)back, reverse_vector_avx2(x));
+	}
+
+	reverse_inplace_scalar(buf + i, len - 2 * i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static inline void reverse_copy_avx512(char *const dst, char const *const src,
+									   size_t const len)
+{
+	size_t i = 0;
+
+	for(; i + 64 <= len; i += 64) {
+		__m512i const x = _mm512_loadu_si512(src + len - i - 64);
+		_mm512_storeu_si512(dst + i, reverse_vector_avx512(x));
+	}
+
+	reverse_copy_scalar(dst + i, src, len - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static inline void reverse_inplace_avx512(char *const buf, size_t const len)
+{
+	size_t i = 0;
+
+	for(; 2 * (i + 64) <= len; i += 64) {
+		char *const front = buf + i;
+		char *const back = buf + len - i - 64;
+		__m512i const x = _mm512_loadu_si512(front);
+		__m512i const y = _mm512_loadu_si512(back);
+		_mm512_storeu_si512(front, reverse_vector_avx512(y));
+		_mm512_storeu_si512(back, reverse_vector_avx512(x));
+	}
+
+	reverse_inplace_scalar(buf + i, len - 2 * i);
+}
+#endif
+
+/* Kernel for the selected tier */
+static inline reverse_fn *reverse_copy_kernel(void)
+{
+	switch(cpu_tier()) {
+#ifdef CPU_X86
+		case tier_avx512:
+			return reverse_copy_avx512;
+		case tier_avx2:
+			return reverse_copy_avx2;
+		case tier_sse2:
+			return reverse_copy_sse2;
+#endif
+		default:
+			return reverse_copy_scalar;
+	}
+}
+
+static inline reverse_inplace_fn *reverse_inplace_kernel(void)
+{
+	switch(cpu_tier()) {
+#ifdef CPU_X86
+		case tier_avx512:
+			return reverse_inplace_avx512;
+		case tier_avx2:
+			return reverse_inplace_avx2;
+		case tier_sse2:
+			return reverse_inplace_sse2;
+#endif
+		default:
+			return reverse_inplace_scalar;
+	}
+}
+
+#endif /* COMMON_REVERSE_H */
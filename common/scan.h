@@ -0,0 +1,127 @@
+/* scan -- find line and word delimiters, reverse the segments between */
+
+#ifndef COMMON_SCAN_H
+#define COMMON_SCAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "reverse.h"
+
+/* Find the next delimiter in [p, end), or return end */
+typedef char *scan_fn(char *p, char *end);
+
+static inline char *scan_lines(char *const p, char *const end)
+{
+	char *const d = memchr(p, '\n', (size_t)(end - p));
+	return d != NULL ? d : end;
+}
+
+/* Words are delimited by ' ' and '\t' through '\r' */
+static inline char *scan_words_scalar(char *p, char *const end)
+{
+	for(; p != end; ++p) {
+		if(*p == ' ' || (unsigned char)(*p - '\t') <= '\r' - '\t')
+			break;
+	}
+
+	return p;
+}
+
+#ifdef CPU_X86
+__attribute__((target("sse2")))
+static inline char *scan_words_sse2(char *p, char *const end)
+{
+	for(; end - p >= 16; p += 16) {
+		__m128i const x = _mm_loadu_si128((__m128i const *)p);
+		__m128i const d = _mm_sub_epi8(x, _mm_set1_epi8('\t'));
+		__m128i const space = _mm_or_si128(
+			_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')),
+			_mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8('\r' - '\t')), d));
+		unsigned const mask = (unsigned)_mm_movemask_epi8(space);
+
+		if(mask != 0)
+			return p + __builtin_ctz(mask);
+	}
+
+	return scan_words_scalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static inline char *scan_words_avx2(char *p, char *const end)
+{
+	for(; end - p >= 32; p += 32) {
+		__m256i const x = _mm256_loadu_si256((__m256i const *)p);
+		__m256i const d = _mm256_sub_epi8(x, _mm256_set1_epi8('\t'));
+		__m256i const space = _mm256_or_si256(
+			_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')),
+			_mm256_cmpeq_epi8(
+				_mm256_min_epu8(d, _mm256_set1_epi8('\r' - '\t')), d));
+		unsigned const mask = (unsigned)_mm256_movemask_epi8(space);
+
+		if(mask != 0)
+			return p + __builtin_ctz(mask);
+	}
+
+	return scan_words_scalar(p, end);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static inline char *scan_words_avx512(char *p, char *const end)
+{
+	for(; end - p >= 64; p += 64) {
+		__m512i const x = _mm512_loadu_si512(p);
+		__m512i const d = _mm512_sub_epi8(x, _mm512_set1_epi8('\t'));
+		__mmask64 const mask =
+			_mm512_cmpeq_epi8_mask(x, _mm512_set1_epi8(' '))
+			| _mm512_cmple_epu8_mask(d, _mm512_set1_epi8('\r' - '\t'));
+
+		if(mask != 0)
+			return p + __builtin_ctzll(mask);
+	}
+
+	return scan_words_scalar(p, end);
+}
+#endif
+
+/* Kernel for the selected tier, lines or words */
+static inline scan_fn *scan_kernel(bool const words)
+{
+	/* glibc's memchr is already vectorized */
+	if(!words)
+		return scan_lines;
+
+	switch(cpu_tier()) {
+#ifdef CPU_X86
+		case tier_avx512:
+			return scan_words_avx512;
+		case tier_avx2:
+			return scan_words_avx2;
+		case tier_sse2:
+			return scan_words_sse2;
+#endif
+		default:
+			return scan_words_scalar;
+	}
+}
+
+/* Reverse every delimited segment in [buf, end) in place, scanning for
+	delimiters from FROM; returns the start of the unterminated tail */
+static inline char *reverse_segments(char *const buf, char *from,
+									 char *const end, scan_fn *const scan,
+									 reverse_inplace_fn *const reverse)
+{
+	char *segment = buf;
+	char *delim;
+
+	while((delim = scan(from, end)) != end) {
+		reverse(segment, (size_t)(delim - segment));
+		segment = from = delim + 1;
+	}
+
+	return segment;
+}
+
+#endif /* COMMON_SCAN_H */
@@ -0,0 +1,103 @@
+/* stream -- large-block file streaming */
+
+#ifndef COMMON_STREAM_H
+#define COMMON_STREAM_H
+
+#include <errno.h>
+#include <error.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Block size used when streaming files */
+#define STREAM_BUFFER_SIZE (1 << 17)
+
+/* In-place transform applied to every block read */
+typedef void stream_fn(char *buf, size_t len, void const *arg);
+
+static inline void write_all(int const fd, char const *buf, size_t len)
+{
+	while(len != 0) {
+		ssize_t const n = write(fd, buf, len);
+
+		if(n < 0) {
+			if(errno == EINTR)
+				continue;
+			error(EXIT_FAILURE, errno, "write error");
+		}
+
+		buf += n;
+		len -= (size_t)n;
+	}
+}
+
+/* Open PATH for reading, '-' is standard input */
+static inline int stream_open(char const *const path)
+{
+	if(strcmp(path, "-") == 0)
+		return STDIN_FILENO;
+
+	int const fd = open(path, O_RDONLY);
+
+	if(fd < 0)
+		error(EXIT_FAILURE, errno, "%s", path);
+
+	(void)posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	return fd;
+}
+
+static inline void stream_close(int const fd, char const *const path)
+{
+	if(fd != STDIN_FILENO && close(fd) != 0)
+		error(EXIT_FAILURE, errno, "%s", path);
+}
+
+/* Read as much as possible into BUF, short only at end of file */
+static inline size_t read_full(int const fd, char *const buf,
+							   size_t const size, char const *const path)
+{
+	size_t len = 0;
+
+	while(len < size) {
+		ssize_t const n = read(fd, buf + len, size - len);
+
+		if(n < 0) {
+			if(errno == EINTR)
+				continue;
+			error(EXIT_FAILURE, errno, "%s", path);
+		} else if(n == 0) {
+			break;
+		}
+
+		len += (size_t)n;
+	}
+
+	return len;
+}
+
+/* Transform a whole file block by block, one write per block */
+static inline void stream_file(char const *const path, stream_fn *const fn,
+							   void const *const arg)
+{
+	static char buf[STREAM_BUFFER_SIZE];
+
+	int const fd = stream_open(path);
+	ssize_t n;
+
+	while((n = read(fd, buf, sizeof(buf))) != 0) {
+		if(n < 0) {
+			if(errno == EINTR)
+				continue;
+			error(EXIT_FAILURE, errno, "%s", path);
+		}
+
+		fn(buf, (size_t)n, arg);
+		write_all(STDOUT_FILENO, buf, (size_t)n);
+	}
+
+	stream_close(fd, path);
+}
+
+#endif /* COMMON_STREAM_H */
@@ -0,0 +1,204 @@
+/* subst -- vector kernels for monoalphabetic letter substitution */
+
+#ifndef COMMON_SUBST_H
+#define COMMON_SUBST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "cpu.h"
+#include "stream.h"
+#include "table.h"
+
+/* Letters in the a-z A-Z ranges */
+#define SUBST_LETTERS 26
+
+/* Byte table plus the image of a-z, split into two 16-lane shuffle tables */
+struct subst_key {
+	table_t table;
+	unsigned char lower[32];
+	bool vector;
+};
+
+/* Derive the shuffle tables from KEY->table. The vector kernels only apply
+	when every non-letter maps to itself, and each uppercase letter maps to
+	the image of its lowercase letter with bit 0x20 cleared; otherwise they
+	fall back to the table.
+	Assumes contiguous character encoding from a-z A-Z */
+static inline void subst_compile(struct subst_key *const key)
+{
+	key->vector = true;
+
+	for(size_t i = 0; i < TABLE_SIZE; ++i) {
+		bool const lower = i >= 'a' && i <= 'z';
+		bool const upper = i >= 'A' && i <= 'Z';
+
+		if(upper) {
+			unsigned char const image = key->table[i - 'A' + 'a'];
+			if(key->table[i] != (image & ~0x20))
+				key->vector = false;
+		} else if(!lower && key->table[i] != i) {
+			key->vector = false;
+		}
+	}
+
+	for(size_t i = 0; i < sizeof(key->lower); ++i) {
+		key->lower[i] = (i < SUBST_LETTERS
+						 ? key->table['a' + i]
+						 : 0);
+	}
+}
+
+static inline void subst_block_scalar(char *const buf, size_t const len,
+									  void const *const arg)
+{
+	struct subst_key const *const key = arg;
+	table_apply(key->table, buf, len);
+}
+
+#ifdef CPU_X86
+/* Substitute letters in 16 bytes: fold case with bit 0x20, look the offset
+	up in both halves of the alphabet, then clear bit 0x20 of the image
+	wherever the input had it clear */
+__attribute__((target("ssse3")))
+static inline __m128i subst_vector_ssse3(__m128i const x, __m128i const lo,
+										 __m128i const hi)
+{
+	__m128i const d = _mm_sub_epi8(_mm_or_si128(x, _mm_set1_epi8(0x20)),
+								   _mm_set1_epi8('a'));
+	__m128i const letter = _mm_cmpeq_epi8(
+		_mm_min_epu8(d, _mm_set1_epi8(SUBST_LETTERS - 1)), d);
+	__m128i const first = _mm_cmpeq_epi8(
+		_mm_min_epu8(d, _mm_set1_epi8(15)), d);
+
+	__m128i const image = _mm_or_si128(
+		_mm_and_si128(first, _mm_shuffle_epi8(lo, d)),
+		_mm_andnot_si128(first, _mm_shuffle_epi8(hi, d)));
+	__m128i const sub = _mm_and_si128(image,
+		_mm_or_si128(x, _mm_set1_epi8((char)~0x20)));
+
+	return _mm_or_si128(_mm_and_si128(letter, sub),
+						_mm_andnot_si128(letter, x));
+}
+
+__attribute__((target("ssse3")))
+static inline void subst_block_ssse3(char *const buf, size_t const len,
+									 void const *const arg)
+{
+	struct subst_key const *const key = arg;
+	__m128i const lo = _mm_loadu_si128((__m128i const *)key->lower);
+	__m128i const hi = _mm_loadu_si128((__m128i const *)(key->lower + 16));
+	size_t i = 0;
+
+	for(; i + 16 <= len; i += 16) {
+		__m128i const x = _mm_loadu_si128((__m128i const *)(buf + i));
+		_mm_storeu_si128((__m128i *)(buf + i),
+						 subst_vector_ssse3(x, lo, hi));
+	}
+
+	table_apply(key->table, buf + i, len - i);
+}
+
+/* Same as subst_vector_ssse3, 32 bytes at a time; vpshufb looks up within
+	each 128-bit lane, so both tables are broadcast to both lanes */
+__attribute__((target("avx2")))
+static inline __m256i subst_vector_avx2(__m256i const x, __m256i const lo,
+										__m256i const hi)
+{
+	__m256i const d = _mm256_sub_epi8(
+		_mm256_or_si256(x, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+	__m256i const letter = _mm256_cmpeq_epi8(
+		_mm256_min_epu8(d, _mm256_set1_epi8(SUBST_LETTERS - 1)), d);
+	__m256i const first = _mm256_cmpeq_epi8(
+		_mm256_min_epu8(d, _mm256_set1_epi8(15)), d);
+
+	__m256i const image = _mm256_blendv_epi8(_mm256_shuffle_epi8(hi, d),
+		_mm256_shuffle_epi8(lo, d), first);
+	__m256i const sub = _mm256_and_si256(image,
+		_mm256_or_si256(x, _mm256_set1_epi8((char)~0x20)));
+
+	return _mm256_blendv_epi8(x, sub, letter);
+}
+
+__attribute__((target("avx2")))
+static inline void subst_block_avx2(char *const buf, size_t const len,
+									void const *const arg)
+{
+	struct subst_key const *const key = arg;
+	__m256i const lo = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((__m128i const *)key->lower));
+	__m256i const hi = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((__m128i const *)(key->lower + 16)));
+	size_t i = 0;
+
+	for(; i + 32 <= len; i += 32) {
+		__m256i const x = _mm256_loadu_si256((__m256i const *)(buf + i));
+		_mm256_storeu_si256((__m256i *)(buf + i),
+							subst_vector_avx2(x, lo, hi));
+	}
+
+	table_apply(key->table, buf + i, len - i);
+}
+
+/* Same as subst_vector_avx2 with mask registers, 64 bytes at a time */
+__attribute__((target("avx512f,avx512bw")))
+static inline __m512i subst_vector_avx512(__m512i const x, __m512i const lo,
+										  __m512i const hi)
+{
+	__m512i const d = _mm512_sub_epi8(
+		_mm512_or_si512(x, _mm512_set1_epi8(0x20)), _mm512_set1_epi8('a'));
+	__mmask64 const letter = _mm512_cmplt_epu8_mask(d,
+		_mm512_set1_epi8(SUBST_LETTERS));
+	__mmask64 const first = _mm512_cmplt_epu8_mask(d, _mm512_set1_epi8(16));
+
+	__m512i const image = _mm512_mask_blend_epi8(first,
+		_mm512_shuffle_epi8(hi, d), _mm512_shuffle_epi8(lo, d));
+	__m512i const sub = _mm512_and_si512(image,
+		_mm512_or_si512(x, _mm512_set1_epi8((char)~0x20)));
+
+	return _mm512_mask_blend_epi8(letter, x, sub);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static inline void subst_block_avx512(char *const buf, size_t const len,
+									  void const *const arg)
+{
+	struct subst_key const *const key = arg;
+	__m512i const lo = _mm512_broadcast_i32x4(
+		_mm_loadu_si128((__m128i const *)key->lower));
+	__m512i const hi = _mm512_broadcast_i32x4(
+		_mm_loadu_si128((__m128i const *)(key->lower + 16)));
+	size_t i = 0;
+
+	for(; i + 64 <= len; i += 64) {
+		__m512i const x = _mm512_loadu_si512(buf + i);
+		_mm512_storeu_si512(buf + i, subst_vector_avx512(x, lo, hi));
+	}
+
+	table_apply(key->table, buf + i, len - i);
+}
+#endif
+
+/* Kernel for the selected tier */
+static inline stream_fn *subst_kernel(struct subst_key const *const key)
+{
+	if(!key->vector)
+		return subst_block_scalar;
+
+	switch(cpu_tier()) {
+#ifdef CPU_X86
+		case tier_avx512:
+			return subst_block_avx512;
+		case tier_avx2:
+			return subst_block_avx2;
+		case tier_sse2:
+			if(cpu_has_ssse3())
+				return subst_block_ssse3;
+			return subst_block_scalar;
+#endif
+		default:
+			return subst_block_scalar;
+	}
+}
+
+#endif /* COMMON_SUBST_H */
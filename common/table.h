@@ -0,0 +1,49 @@
+/* table -- 256-entry byte translation tables */
+
+#ifndef COMMON_TABLE_H
+#define COMMON_TABLE_H
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/* One entry per possible byte value */
+#define TABLE_SIZE (UCHAR_MAX + 1)
+
+/* Translation table, indexed by the unsigned value of the input byte */
+typedef unsigned char table_t[TABLE_SIZE];
+
+/* Translate a buffer in place, one load per byte */
+static inline void table_apply(unsigned char const *const table,
+							   char *const buf, size_t const len)
+{
+	unsigned char *const p = (unsigned char *)buf;
+
+	for(size_t i = 0; i < len; ++i)
+		p[i] = table[p[i]];
+}
+
+/* Same as table_apply, shaped as a stream_fn */
+static inline void table_block(char *const buf, size_t const len,
+							   void const *const table)
+{
+	table_apply(table, buf, len);
+}
+
+/* Make TABLE apply NEXT after itself, so one lookup does both */
+static inline void table_compose(unsigned char *const table,
+								 unsigned char const *const next)
+{
+	for(size_t i = 0; i < TABLE_SIZE; ++i)
+		table[i] = next[table[i]];
+}
+
+/* Print a string through a table */
+static inline void table_puts(unsigned char const *const table,
+							  char const *const string)
+{
+	for(size_t i = 0; string[i]; ++i)
+		putchar(table[(unsigned char)string[i]]);
+}
+
+#endif /* COMMON_TABLE_H */
@@ -1,12 +1,24 @@
 /* null-cipher -- create a ciphertext from positions of letters in a string */
 
+#include <ctype.h>
+#include <errno.h>
 #include <error.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <inttypes.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../common/cpu.h"
+#include "../common/stream.h"
+#include "../common/table.h"
 
 #define _warn(...) do {					\
 		if(!quiet)						\
@@ -17,8 +29,13 @@
 static bool quiet;
 
 static struct option const long_opts[] = {
+	{"cover", required_argument, NULL, 'c'},
+	{"encode", no_argument, NULL, 'e'},
 	{"help", no_argument, NULL, 'h'},
 	{"index", required_argument, NULL, 'i'},
+	{"index-file", required_argument, NULL, 'x'},
+	{"isa", required_argument, NULL, 'I'},
+	{"positions", required_argument, NULL, 'p'},
 	{"quiet", no_argument, NULL, 'q'},
 
 	{NULL, 0, NULL, 0}
@@ -26,16 +43,32 @@ static struct option const long_opts[] = {
 
 static _Noreturn void usage(int const status, char const *const name)
 {
-	printf("Usage: %s [OPTION]... KEY [POSITION]...\n\n", name);
+	printf("Usage: %s [OPTION]... KEY [POSITION]...\n", name);
+	printf("  or:  %s [OPTION]... -c FILE [POSITION]...\n", name);
+	printf("  or:  %s [OPTION]... -e -c FILE [MESSAGE]...\n\n", name);
 	if(status != EXIT_SUCCESS) {
 		fprintf(stderr, "Try '%s --help' for more information.\n", name);
 	} else {
 		puts("Create a ciphertext from positions of letters in a string.");
 		printf("Example: %s \"Hello World\" 1 2\n", name);
 		puts("\nOptions:\n\
-  -h, --help         display this help text and exit\n\
-  -i, --index=NUM    begin indexing at NUM (default: 0)\n\
-  -q, --quiet        disable warnings");
+  -c, --cover=FILE       use the words of FILE as the key\n\
+  -e, --encode           with '--cover', print a word of FILE for\n\
+                         every character of each MESSAGE, holding\n\
+                         that character at the '--index' offset\n\
+  -h, --help             display this help text and exit\n\
+  -i, --index=NUM        begin indexing at NUM (default: 0)\n\
+  -I, --isa=TIER         force the scalar, sse2, avx2 or avx512\n\
+                         kernels (default: widest supported,\n\
+                         or $CIPHER_ISA)\n\
+  -p, --positions=FILE   with '--cover', read POSITIONs from FILE;\n\
+                         when FILE is -, or without POSITIONs,\n\
+                         read standard input\n\
+  -q, --quiet            disable warnings\n\
+  -x, --index-file=FILE  with '--cover', load the word index from\n\
+                         FILE; when FILE is missing or was built\n\
+                         from another version of the cover text,\n\
+                         index the cover and write FILE");
 	}
 
 	exit(status);
@@ -54,6 +87,513 @@ static void null_cipher(char const *const string, char const *const key,
 	printf("%c ", string[index + place]);
 }
 
+/* Word separators, the same set the KEY is tokenized with */
+static char const delim[] = " ,.\t\n";
+
+/* One word of the cover text */
+struct word {
+	uint64_t start;
+	uint64_t len;
+};
+
+/* Cover text and the offset of every word in it */
+struct cover {
+	char const *text;
+	size_t size;
+
+	struct word *word;
+	size_t count;
+	size_t cap;
+};
+
+/* Bit i of the result is set when P[i] is a separator */
+typedef uint64_t delim_fn(char const *p);
+
+static uint64_t delim_scalar(char const *const p)
+{
+	uint64_t mask = 0;
+
+	for(size_t i = 0; i < 64; ++i) {
+		if(p[i] != '\0' && strchr(delim, p[i]) != NULL)
+			mask |= (uint64_t)1 << i;
+	}
+
+	return mask;
+}
+
+#ifdef CPU_X86
+__attribute__((target("sse2")))
+static uint64_t delim_sse2(char const *const p)
+{
+	uint64_t mask = 0;
+
+	for(size_t v = 0; v < 4; ++v) {
+		__m128i const x = _mm_loadu_si128((__m128i const *)(p + 16 * v));
+		__m128i m = _mm_cmpeq_epi8(x, _mm_set1_epi8(delim[0]));
+
+		for(size_t i = 1; i < sizeof(delim) - 1; ++i)
+			m = _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8(delim[i])));
+
+		mask |= (uint64_t)(unsigned)_mm_movemask_epi8(m) << (16 * v);
+	}
+
+	return mask;
+}
+
+__attribute__((target("avx2")))
+static uint64_t delim_avx2(char const *const p)
+{
+	uint64_t mask = 0;
+
+	for(size_t v = 0; v < 2; ++v) {
+		__m256i const x = _mm256_loadu_si256((__m256i const *)(p + 32 * v));
+		__m256i m = _mm256_cmpeq_epi8(x, _mm256_set1_epi8(delim[0]));
+
+		for(size_t i = 1; i < sizeof(delim) - 1; ++i) {
+			m = _mm256_or_si256(m,
+				_mm256_cmpeq_epi8(x, _mm256_set1_epi8(delim[i])));
+		}
+
+		mask |= (uint64_t)(unsigned)_mm256_movemask_epi8(m) << (32 * v);
+	}
+
+	return mask;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static uint64_t delim_avx512(char const *const p)
+{
+	__m512i const x = _mm512_loadu_si512(p);
+	__mmask64 mask = 0;
+
+	for(size_t i = 0; i < sizeof(delim) - 1; ++i)
+		mask |= _mm512_cmpeq_epi8_mask(x, _mm512_set1_epi8(delim[i]));
+
+	return mask;
+}
+#endif
+
+static delim_fn *delim_kernel(void)
+{
+	switch(cpu_tier()) {
+#ifdef CPU_X86
+		case tier_avx512:
+			return delim_avx512;
+		case tier_avx2:
+			return delim_avx2;
+		case tier_sse2:
+			return delim_sse2;
+#endif
+		default:
+			return delim_scalar;
+	}
+}
+
+static void cover_grow(struct cover *const cover, size_t const need)
+{
+	if(cover->count + need <= cover->cap)
+		return;
+
+	size_t cap = cover->cap ? cover->cap : 4096;
+
+	while(cap < cover->count + need)
+		cap *= 2;
+
+	struct word *const word = realloc(cover->word, cap * sizeof(*word));
+
+	if(word == NULL)
+		error(EXIT_FAILURE, errno, "error allocating word index");
+
+	cover->word = word;
+	cover->cap = cap;
+}
+
+/* Index every word in one pass: 64 bytes are classified at a time and
+	word boundaries are the edges of the separator mask */
+static void cover_index(struct cover *const cover, delim_fn *const classify)
+{
+	char tail[64];
+	uint64_t carry = 0;
+	size_t ends = 0;
+
+	cover->count = 0;
+
+	for(size_t i = 0; i < cover->size; i += 64) {
+		char const *p = cover->text + i;
+
+		/* Bytes past the end count as separators */
+		if(cover->size - i < 64) {
+			memset(tail, delim[0], sizeof(tail));
+			memcpy(tail, p, cover->size - i);
+			p = tail;
+		}
+
+		uint64_t const word = ~classify(p);
+		uint64_t const prev = (word << 1) | carry;
+		uint64_t starts = word & ~prev;
+		uint64_t stops = ~word & prev;
+
+		carry = word >> 63;
+		cover_grow(cover, 32);
+
+		for(; starts != 0; starts &= starts - 1) {
+			cover->word[cover->count++].start =
+				i + (uint64_t)__builtin_ctzll(starts);
+		}
+
+		for(; stops != 0; stops &= stops - 1, ++ends) {
+			cover->word[ends].len = i + (uint64_t)__builtin_ctzll(stops)
+				- cover->word[ends].start;
+		}
+	}
+
+	/* The last word runs to the end of a text that is a multiple of 64 */
+	if(ends < cover->count)
+		cover->word[ends].len = cover->size - cover->word[ends].start;
+}
+
+/* On-disk word index: a header followed by the struct word array, read
+	back with mmap. Bump the version whenever the layout or the separator
+	set changes */
+#define INDEX_MAGIC "NULLIDX"
+#define INDEX_VERSION 1
+
+struct index_header {
+	char magic[8];
+	uint32_t version;
+
+	/* Written as 1, anything else is a foreign byte order */
+	uint32_t byte_order;
+
+	/* Cover text the index was built from */
+	uint64_t text_size;
+	int64_t text_mtime;
+	int64_t text_mtime_nsec;
+
+	uint64_t count;
+};
+
+static void index_header(struct index_header *const h,
+						 struct cover const *const cover,
+						 struct stat const *const st)
+{
+	memset(h, 0, sizeof(*h));
+	memcpy(h->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+	h->version = INDEX_VERSION;
+	h->byte_order = 1;
+	h->text_size = cover->size;
+	h->text_mtime = st->st_mtim.tv_sec;
+	h->text_mtime_nsec = st->st_mtim.tv_nsec;
+	h->count = cover->count;
+}
+
+/* Every word must lie within the cover text, a corrupt entry would
+	otherwise send lookups past its end */
+static bool index_words_valid(struct word const *const word,
+							  size_t const count, uint64_t const text_size)
+{
+	for(size_t i = 0; i < count; ++i) {
+		if(word[i].start > text_size
+		   || word[i].len > text_size - word[i].start)
+			return false;
+	}
+
+	return true;
+}
+
+/* Map the index at PATH if it matches the cover text, returns false
+	when it is missing, stale or corrupt */
+static bool index_load(struct cover *const cover, char const *const path,
+					   struct stat const *const text_st)
+{
+	int const fd = open(path, O_RDONLY);
+
+	if(fd < 0) {
+		if(errno == ENOENT)
+			return false;
+		error(EXIT_FAILURE, errno, "%s", path);
+	}
+
+	struct stat st;
+	struct index_header want;
+	void *map = MAP_FAILED;
+	bool ok = false;
+
+	if(fstat(fd, &st) != 0)
+		error(EXIT_FAILURE, errno, "%s", path);
+
+	if(S_ISREG(st.st_mode) && (size_t)st.st_size >= sizeof(want))
+		map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	stream_close(fd, path);
+
+	if(map != MAP_FAILED) {
+		struct index_header const *const h = map;
+
+		cover->count = h->count;
+		index_header(&want, cover, text_st);
+
+		ok = memcmp(h, &want, offsetof(struct index_header, count)) == 0
+			&& h->count <= ((size_t)st.st_size - sizeof(*h))
+				/ sizeof(struct word)
+			&& (size_t)st.st_size == sizeof(*h)
+				+ h->count * sizeof(struct word)
+			&& index_words_valid((struct word const *)(h + 1), h->count,
+								 h->text_size);
+
+		if(!ok)
+			munmap(map, (size_t)st.st_size);
+	}
+
+	if(!ok) {
+		cover->count = 0;
+		_warn("%s: index is stale, corrupt or unreadable, rebuilding", path);
+		return false;
+	}
+
+	cover->word = (struct word *)((char *)map + sizeof(struct index_header));
+	return true;
+}
+
+/* Write the index next to PATH and move it into place */
+static void index_save(struct cover const *const cover,
+					   char const *const path,
+					   struct stat const *const text_st)
+{
+	size_t const len = strlen(path);
+	char *const tmp = malloc(len + sizeof(".tmp"));
+
+	if(tmp == NULL)
+		error(EXIT_FAILURE, errno, "error allocating buffer");
+
+	memcpy(tmp, path, len);
+	memcpy(tmp + len, ".tmp", sizeof(".tmp"));
+
+	int const fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+	if(fd < 0)
+		error(EXIT_FAILURE, errno, "%s", tmp);
+
+	struct index_header h;
+	index_header(&h, cover, text_st);
+
+	write_all(fd, (char const *)&h, sizeof(h));
+	write_all(fd, (char const *)cover->word,
+			  cover->count * sizeof(*cover->word));
+
+	if(close(fd) != 0)
+		error(EXIT_FAILURE, errno, "%s", tmp);
+
+	if(rename(tmp, path) != 0)
+		error(EXIT_FAILURE, errno, "%s", path);
+
+	free(tmp);
+}
+
+/* Map the cover text at PATH and index its words, through the index
+	file at INDEX_PATH when one is given */
+static void cover_open(struct cover *const cover, char const *const path,
+					   char const *const index_path)
+{
+	int const fd = stream_open(path);
+	struct stat st;
+
+	if(fstat(fd, &st) != 0)
+		error(EXIT_FAILURE, errno, "%s", path);
+
+	if(!S_ISREG(st.st_mode))
+		error(EXIT_FAILURE, 0, "%s: cover text must be a regular file", path);
+
+	memset(cover, 0, sizeof(*cover));
+	cover->size = (size_t)st.st_size;
+
+	if(cover->size != 0) {
+		void *const map = mmap(NULL, cover->size, PROT_READ, MAP_PRIVATE,
+							   fd, 0);
+
+		if(map == MAP_FAILED)
+			error(EXIT_FAILURE, errno, "%s", path);
+
+		cover->text = map;
+	}
+
+	stream_close(fd, path);
+
+	if(index_path == NULL || !index_load(cover, index_path, &st)) {
+		if(cover->size != 0) {
+			(void)madvise((void *)cover->text, cover->size, MADV_SEQUENTIAL);
+			(void)madvise((void *)cover->text, cover->size, MADV_WILLNEED);
+		}
+
+		cover_index(cover, delim_kernel());
+
+		if(index_path != NULL)
+			index_save(cover, index_path, &st);
+	}
+
+	/* Lookups jump around the text from here on */
+	if(cover->size != 0)
+		(void)madvise((void *)cover->text, cover->size, MADV_RANDOM);
+}
+
+/* Positions answered so far, with buffered output */
+struct lookup {
+	struct cover const *cover;
+	uintmax_t index;
+
+	size_t next;
+	uintmax_t missing;
+	uintmax_t ignored;
+
+	size_t len;
+	char out[STREAM_BUFFER_SIZE];
+};
+
+/* Answer position PLACE for the next word */
+static void lookup_one(struct lookup *const l, uintmax_t const place)
+{
+	if(l->next == l->cover->count) {
+		++l->ignored;
+		return;
+	}
+
+	struct word const *const w = &l->cover->word[l->next++];
+
+	if(sizeof(l->out) - l->len < 3) {
+		write_all(STDOUT_FILENO, l->out, l->len);
+		l->len = 0;
+	}
+
+	if(place > UINTMAX_MAX - l->index || w->len <= l->index + place) {
+		++l->missing;
+	} else {
+		l->out[l->len++] = l->cover->text[w->start + l->index + place];
+		l->out[l->len++] = ' ';
+	}
+
+	l->out[l->len++] = '\n';
+}
+
+/* Parse unsigned decimal positions separated by anything else */
+static void lookup_file(struct lookup *const l, char const *const path)
+{
+	static char in[STREAM_BUFFER_SIZE];
+
+	int const fd = stream_open(path);
+	uintmax_t place = 0;
+	bool digits = false;
+	size_t n;
+
+	while((n = read_full(fd, in, sizeof(in), path)) != 0) {
+		for(size_t i = 0; i < n; ++i) {
+			unsigned const d = (unsigned char)in[i] - (unsigned)'0';
+
+			if(d <= 9) {
+				place = place > (UINTMAX_MAX - d) / 10
+					? UINTMAX_MAX : place * 10 + d;
+				digits = true;
+			} else if(digits) {
+				lookup_one(l, place);
+				place = 0;
+				digits = false;
+			}
+		}
+	}
+
+	if(digits)
+		lookup_one(l, place);
+
+	stream_close(fd, path);
+}
+
+static void lookup_finish(struct lookup *const l)
+{
+	write_all(STDOUT_FILENO, l->out, l->len);
+	l->len = 0;
+
+	if(l->missing != 0)
+		_warn("%ju indices in string not found", l->missing);
+
+	if(l->ignored != 0)
+		_warn("%ju positions past the last word ignored", l->ignored);
+}
+
+/* Words of the cover by the character they hold at one offset, letters
+	folded to lower case. Each bucket is handed out round-robin so a
+	message does not reuse the same word for every repeated letter */
+struct invert {
+	size_t first[TABLE_SIZE + 1];
+	size_t next[TABLE_SIZE];
+	uint64_t *word;
+
+	uintmax_t missing;
+};
+
+static void invert_build(struct invert *const inv,
+						 struct cover const *const cover,
+						 uintmax_t const offset)
+{
+	memset(inv, 0, sizeof(*inv));
+
+	for(size_t i = 0; i < cover->count; ++i) {
+		struct word const *const w = &cover->word[i];
+
+		if(w->len > offset)
+			++inv->first[tolower(
+				(unsigned char)cover->text[w->start + offset]) + 1];
+	}
+
+	for(size_t c = 0; c < TABLE_SIZE; ++c)
+		inv->first[c + 1] += inv->first[c];
+
+	inv->word = malloc((inv->first[TABLE_SIZE] + 1) * sizeof(*inv->word));
+
+	if(inv->word == NULL)
+		error(EXIT_FAILURE, errno, "error allocating inverted index");
+
+	for(size_t i = 0; i < cover->count; ++i) {
+		struct word const *const w = &cover->word[i];
+
+		if(w->len > offset) {
+			size_t const c = (size_t)tolower(
+				(unsigned char)cover->text[w->start + offset]);
+			inv->word[inv->first[c] + inv->next[c]++] = i;
+		}
+	}
+
+	memset(inv->next, 0, sizeof(inv->next));
+}
+
+/* Print one cover word for every character of MESSAGE */
+static void invert_encode(struct invert *const inv,
+						  struct cover const *const cover,
+						  char const *const message)
+{
+	bool first = true;
+
+	for(char const *m = message; *m; ++m) {
+		size_t const c = (size_t)tolower((unsigned char)*m);
+		size_t const n = inv->first[c + 1] - inv->first[c];
+
+		if(n == 0) {
+			++inv->missing;
+			continue;
+		}
+
+		struct word const *const w =
+			&cover->word[inv->word[inv->first[c] + inv->next[c]]];
+
+		inv->next[c] = (inv->next[c] + 1) % n;
+
+		if(!first)
+			putchar(' ');
+		fwrite(cover->text + w->start, 1, w->len, stdout);
+		first = false;
+	}
+
+	putchar('\n');
+}
+
 int main(int const argc, char *const *const argv)
 {
 	quiet = false;
@@ -62,29 +602,92 @@ int main(int const argc, char *const *const argv)
 
 	/* Used for tokenizing key */
 	char const *token;
-	char const *const delim = " ,.\t\n";
+
+	char const *cover_path = NULL;
+	char const *positions_path = NULL;
+	char const *index_path = NULL;
+	bool encode = false;
 
 	static char const *const default_strings_list[] = {NULL};
 	char const *const *strings_list;
 
 	int c;
 
-	while((c = getopt_long(argc, argv, "hiq", long_opts, NULL)) != -1) {
+	while((c = getopt_long(argc, argv, "c:ehi:I:p:qx:", long_opts, NULL)) != -1) {
 		switch(c) {
+			case 'c':
+				cover_path = optarg;
+				break;
+			case 'e':
+				encode = true;
+				break;
 			case 'h':
 				usage(EXIT_SUCCESS, argv[0]);
 				break;
 			case 'i':
 				index = strtoumax(optarg, NULL, 10);
 				break;
+			case 'I':
+				cpu_select(optarg);
+				break;
+			case 'p':
+				positions_path = optarg;
+				break;
 			case 'q':
 				quiet = true;
 				break;
+			case 'x':
+				index_path = optarg;
+				break;
 			default:
 				usage(EXIT_FAILURE, argv[0]);
 		}
 	}
 
+	if(cover_path != NULL) {
+		static struct lookup l;
+		struct cover cover;
+
+		cover_open(&cover, cover_path, index_path);
+
+		if(encode) {
+			static struct invert inv;
+
+			invert_build(&inv, &cover, index);
+
+			for(int i = optind; i < argc; ++i)
+				invert_encode(&inv, &cover, argv[i]);
+
+			if(inv.missing != 0) {
+				_warn("%ju characters have no word holding them at "
+					  "index %ju, skipped", inv.missing, index);
+			}
+
+			return EXIT_SUCCESS;
+		}
+		l.cover = &cover;
+		l.index = index;
+
+		if(positions_path != NULL || optind == argc) {
+			lookup_file(&l, positions_path ? positions_path : "-");
+		} else {
+			for(int i = optind; i < argc; ++i)
+				lookup_one(&l, strtoumax(argv[i], NULL, 10));
+		}
+
+		lookup_finish(&l);
+		return EXIT_SUCCESS;
+	}
+
+	if(positions_path != NULL)
+		error(EXIT_FAILURE, 0, "'--positions' requires '--cover'");
+
+	if(encode)
+		error(EXIT_FAILURE, 0, "'--encode' requires '--cover'");
+
+	if(index_path != NULL)
+		error(EXIT_FAILURE, 0, "'--index-file' requires '--cover'");
+
 	char const *const key = argv[optind++];
 
 	if(key == NULL)
@@ -3,11 +3,16 @@
 #include <ctype.h>
 #include <error.h>
 #include <getopt.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "../common/cpu.h"
+#include "../common/stream.h"
+#include "../common/table.h"
+
 #define _warn(...) do {					\
 		if(!quiet)						\
 			error(0, 0, __VA_ARGS__);	\
@@ -22,12 +27,16 @@ enum cipher_mode {
 };
 
 static struct option const long_opts[] = {
+	{"alnum", no_argument, NULL, 'a'},
 	{"decrypt", no_argument, NULL, 'd'},
 	{"encrypt", no_argument, NULL, 'e'},
+	{"files", no_argument, NULL, 'f'},
 
 	{"help", no_argument, NULL, 'h'},
 	{"i", no_argument, NULL, 'i'},
+	{"isa", required_argument, NULL, 'I'},
 	{"j", no_argument, NULL, 'j'},
+	{"key", required_argument, NULL, 'k'},
 
 	{"quiet", no_argument, NULL, 'q'},
 
@@ -36,138 +45,890 @@ static struct option const long_opts[] = {
 
 static _Noreturn void usage(int const status, char const *const name)
 {
-	printf("Usage: %s [OPTION]... [STRING/COORD]...\n\n", name);
+	printf("Usage: %s [OPTION]... [STRING/COORD]...\n", name);
+	printf("  or:  %s [OPTION]... -f [FILE]...\n\n", name);
 	if(status != EXIT_SUCCESS) {
 		fprintf(stderr, "Try '%s --help' for more information.\n", name);
 	} else {
 		puts("Map alphabet characters to digits.");
 		printf("Example: %s -e Hello World\n", name);
 		puts("\nOptions:\n\
+  -a, --alnum      use a 6x6 square of A-Z and 0-9\n\
   -d, --decrypt    decrypt input strings (use coordinates)\n\
   -e, --encrypt    encrypt input strings (use strings)\n\
+  -f, --files      read FILEs instead of STRINGs/COORDs; with\n\
+                   no FILE, or when FILE is -, read standard\n\
+                   input. When decrypting, coordinate pairs\n\
+                   may be separated by spaces or commas\n\
   -h, --help       display this help text and exit\n\
-  -i, --i          coordinate 24 represents 'I' (default)\n\
-  -j, --j          coordinate 24 represents 'J'\n\
+  -i, --i          'I' and 'J' share the cell of 'I' (default)\n\
+  -I, --isa=TIER   force the scalar, sse2, avx2 or avx512\n\
+                   kernels (default: widest supported,\n\
+                   or $CIPHER_ISA)\n\
+  -j, --j          'I' and 'J' share the cell of 'J'\n\
+  -k, --key=KEY    fill the square with KEY first, then the\n\
+                   rest of the alphabet\n\
   -q, --quiet      disable warnings");
 	}
 
 	exit(status);
 }
 
-/* Traditional 5x5 polybius square */
-static char square[5][5] = {
-	{'A', 'B', 'C', 'D', 'E'},
-	{'F', 'G', 'H', 'I', 'K'},
-	{'L', 'M', 'N', 'O', 'P'},
-	{'Q', 'R', 'S', 'T', 'U'},
-	{'V', 'W', 'X', 'Y', 'Z'}
+/* Encoder output for every byte: "RC " or nothing at all */
+struct polybius_enc {
+	char code[TABLE_SIZE][4];
+	unsigned char len[TABLE_SIZE];
+
+	/* Row and column digits of a-z, split in two 16-lane halves */
+	char row[32];
+	char col[32];
+};
+
+/* Largest square side, A-Z and 0-9 */
+#define SQUARE_MAX 6
+
+/* Square layout with its forward and inverse maps, built once at
+   startup and shared read-only by every input */
+struct polybius {
+	size_t size;
+
+	/* Cells in row order, padded to three 16-lane halves */
+	char cell[48];
+
+	struct polybius_enc enc;
 };
 
-/* Map letters to coordinates,
-   assumes contiguous character encoding from a-z */
-static char const *const square_map['z' - 'a' + 1] = {
-	['a' - 'a'] = "11",
-	['b' - 'a'] = "12",
-	['c' - 'a'] = "13",
-	['d' - 'a'] = "14",
-	['e' - 'a'] = "15",
-	['f' - 'a'] = "21",
-	['g' - 'a'] = "22",
-	['h' - 'a'] = "23",
-	['i' - 'a'] = "24",
-	['j' - 'a'] = "24", /* Same value as 'I' */
-	['k' - 'a'] = "25",
-	['l' - 'a'] = "31",
-	['m' - 'a'] = "32",
-	['n' - 'a'] = "33",
-	['o' - 'a'] = "34",
-	['p' - 'a'] = "35",
-	['q' - 'a'] = "41",
-	['r' - 'a'] = "42",
-	['s' - 'a'] = "43",
-	['t' - 'a'] = "44",
-	['u' - 'a'] = "45",
-	['v' - 'a'] = "51",
-	['w' - 'a'] = "52",
-	['x' - 'a'] = "53",
-	['y' - 'a'] = "54",
-	['z' - 'a'] = "55"
+/* Fill the square with KEY followed by the rest of the alphabet, each
+   character once. The 5x5 square holds 'I' and 'J' in the one cell
+   of MERGED, the 6x6 square appends the digits */
+static void polybius_build(struct polybius *const sq, char const *const key,
+						   bool const alnum, char const merged)
+{
+	char const *const fill[] = {
+		key, "ABCDEFGHIJKLMNOPQRSTUVWXYZ", alnum ? "0123456789" : ""
+	};
+	char const omitted = merged == 'I' ? 'J' : 'I';
+	bool used[TABLE_SIZE] = {false};
+	size_t n = 0;
+
+	sq->size = alnum ? SQUARE_MAX : 5;
+	memset(sq->cell, 0, sizeof(sq->cell));
+
+	for(size_t i = 0; i < sizeof(fill) / sizeof(fill[0]); ++i) {
+		for(char const *c = fill[i]; *c; ++c) {
+			unsigned char ch = (unsigned char)toupper(*c);
+
+			if(!alnum && ch == omitted)
+				ch = (unsigned char)merged;
+
+			if(!used[ch]) {
+				used[ch] = true;
+				sq->cell[n++] = (char)ch;
+			}
+		}
+	}
+
+	struct polybius_enc *const enc = &sq->enc;
+
+	memset(enc->code, 0, sizeof(enc->code));
+	memset(enc->len, 0, sizeof(enc->len));
+
+	for(size_t i = 0; i < sq->size * sq->size; ++i) {
+		char const code[4] = {
+			(char)('1' + i / sq->size), (char)('1' + i % sq->size), ' ', 0
+		};
+		unsigned char const ch = (unsigned char)sq->cell[i];
+
+		memcpy(enc->code[ch], code, sizeof(code));
+		memcpy(enc->code[tolower(ch)], code, sizeof(code));
+		enc->len[ch] = enc->len[tolower(ch)] = 3;
+
+		if(!alnum && ch == merged) {
+			memcpy(enc->code[(unsigned char)omitted], code, sizeof(code));
+			memcpy(enc->code[tolower(omitted)], code, sizeof(code));
+			enc->len[(unsigned char)omitted] = 3;
+			enc->len[tolower(omitted)] = 3;
+		}
+	}
+
+	memset(enc->row, 0, sizeof(enc->row));
+	memset(enc->col, 0, sizeof(enc->col));
+
+	for(size_t i = 0; i < 'z' - 'a' + 1; ++i) {
+		enc->row[i] = enc->code['a' + i][0];
+		enc->col[i] = enc->code['a' + i][1];
+	}
+}
+
+/* Encode SRC into DST, which needs room for 3 * LEN + 1 bytes;
+	unmappable bytes are skipped. Returns the bytes written */
+typedef size_t encode_fn(struct polybius_enc const *enc, char *dst,
+						 char const *src, size_t len);
+
+/* Every entry is copied whole, only the advance depends on the byte */
+static size_t encode_scalar(struct polybius_enc const *const enc,
+							char *const dst, char const *const src,
+							size_t const len)
+{
+	char *p = dst;
+
+	for(size_t i = 0; i < len; ++i) {
+		unsigned char const ch = (unsigned char)src[i];
+		memcpy(p, enc->code[ch], sizeof(enc->code[ch]));
+		p += enc->len[ch];
+	}
+
+	return (size_t)(p - dst);
+}
+
+#ifdef CPU_X86
+/* Shuffle masks spreading 16 row digits, 16 column digits and spaces
+	over 48 output bytes */
+static char const expand_row[3][16] = {
+	{0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5},
+	{-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1},
+	{-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1}
+};
+
+static char const expand_col[3][16] = {
+	{-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1},
+	{5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10},
+	{-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1}
+};
+
+static char const expand_space[3][16] = {
+	{0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0},
+	{0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0},
+	{' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' '}
+};
+
+/* Write "RC " for 16 letters given their row and column digits */
+__attribute__((target("ssse3")))
+static inline void expand_ssse3(char *const dst, __m128i const row,
+								__m128i const col)
+{
+	for(size_t v = 0; v < 3; ++v) {
+		__m128i const r = _mm_shuffle_epi8(row,
+			_mm_loadu_si128((__m128i const *)expand_row[v]));
+		__m128i const c = _mm_shuffle_epi8(col,
+			_mm_loadu_si128((__m128i const *)expand_col[v]));
+		__m128i const sp = _mm_loadu_si128((__m128i const *)expand_space[v]);
+
+		_mm_storeu_si128((__m128i *)(dst + 16 * v),
+						 _mm_or_si128(_mm_or_si128(r, c), sp));
+	}
+}
+
+/* Look up the digits of 16 letters, returns false unless all are letters */
+__attribute__((target("ssse3")))
+static inline bool digits_ssse3(struct polybius_enc const *const enc,
+								__m128i const x, __m128i *const row,
+								__m128i *const col)
+{
+	__m128i const d = _mm_sub_epi8(_mm_or_si128(x, _mm_set1_epi8(0x20)),
+								   _mm_set1_epi8('a'));
+	__m128i const letter = _mm_cmpeq_epi8(
+		_mm_min_epu8(d, _mm_set1_epi8('z' - 'a')), d);
+
+	if(_mm_movemask_epi8(letter) != 0xffff)
+		return false;
+
+	__m128i const first = _mm_cmpeq_epi8(
+		_mm_min_epu8(d, _mm_set1_epi8(15)), d);
+	__m128i const row_lo = _mm_loadu_si128((__m128i const *)enc->row);
+	__m128i const row_hi = _mm_loadu_si128((__m128i const *)(enc->row + 16));
+	__m128i const col_lo = _mm_loadu_si128((__m128i const *)enc->col);
+	__m128i const col_hi = _mm_loadu_si128((__m128i const *)(enc->col + 16));
+
+	*row = _mm_or_si128(_mm_and_si128(first, _mm_shuffle_epi8(row_lo, d)),
+		_mm_andnot_si128(first, _mm_shuffle_epi8(row_hi, d)));
+	*col = _mm_or_si128(_mm_and_si128(first, _mm_shuffle_epi8(col_lo, d)),
+		_mm_andnot_si128(first, _mm_shuffle_epi8(col_hi, d)));
+
+	return true;
+}
+
+/* Runs of 16 letters take the vector path, anything else the table */
+__attribute__((target("ssse3")))
+static size_t encode_ssse3(struct polybius_enc const *const enc,
+						   char *const dst, char const *const src,
+						   size_t const len)
+{
+	char *p = dst;
+	size_t i = 0;
+
+	for(; i + 16 <= len; i += 16) {
+		__m128i const x = _mm_loadu_si128((__m128i const *)(src + i));
+		__m128i row, col;
+
+		if(digits_ssse3(enc, x, &row, &col)) {
+			expand_ssse3(p, row, col);
+			p += 48;
+		} else {
+			p += encode_scalar(enc, p, src + i, 16);
+		}
+	}
+
+	return (size_t)(p - dst) + encode_scalar(enc, p, src + i, len - i);
+}
+
+/* Classify and look up 32 letters at once, then expand each half */
+__attribute__((target("avx2")))
+static size_t encode_avx2(struct polybius_enc const *const enc,
+						  char *const dst, char const *const src,
+						  size_t const len)
+{
+	__m256i const row_lo = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((__m128i const *)enc->row));
+	__m256i const row_hi = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((__m128i const *)(enc->row + 16)));
+	__m256i const col_lo = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((__m128i const *)enc->col));
+	__m256i const col_hi = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((__m128i const *)(enc->col + 16)));
+
+	char *p = dst;
+	size_t i = 0;
+
+	for(; i + 32 <= len; i += 32) {
+		__m256i const x = _mm256_loadu_si256((__m256i const *)(src + i));
+		__m256i const d = _mm256_sub_epi8(
+			_mm256_or_si256(x, _mm256_set1_epi8(0x20)),
+			_mm256_set1_epi8('a'));
+		__m256i const letter = _mm256_cmpeq_epi8(
+			_mm256_min_epu8(d, _mm256_set1_epi8('z' - 'a')), d);
+
+		if(_mm256_movemask_epi8(letter) != -1) {
+			p += encode_scalar(enc, p, src + i, 32);
+			continue;
+		}
+
+		__m256i const first = _mm256_cmpeq_epi8(
+			_mm256_min_epu8(d, _mm256_set1_epi8(15)), d);
+		__m256i const row = _mm256_blendv_epi8(
+			_mm256_shuffle_epi8(row_hi, d),
+			_mm256_shuffle_epi8(row_lo, d), first);
+		__m256i const col = _mm256_blendv_epi8(
+			_mm256_shuffle_epi8(col_hi, d),
+			_mm256_shuffle_epi8(col_lo, d), first);
+
+		expand_ssse3(p, _mm256_castsi256_si128(row),
+					 _mm256_castsi256_si128(col));
+		expand_ssse3(p + 48, _mm256_extracti128_si256(row, 1),
+					 _mm256_extracti128_si256(col, 1));
+		p += 96;
+	}
+
+	return (size_t)(p - dst) + encode_scalar(enc, p, src + i, len - i);
+}
+
+/* Same as encode_avx2, 64 letters at a time */
+__attribute__((target("avx512f,avx512bw")))
+static size_t encode_avx512(struct polybius_enc const *const enc,
+							char *const dst, char const *const src,
+							size_t const len)
+{
+	__m512i const row_lo = _mm512_broadcast_i32x4(
+		_mm_loadu_si128((__m128i const *)enc->row));
+	__m512i const row_hi = _mm512_broadcast_i32x4(
+		_mm_loadu_si128((__m128i const *)(enc->row + 16)));
+	__m512i const col_lo = _mm512_broadcast_i32x4(
+		_mm_loadu_si128((__m128i const *)enc->col));
+	__m512i const col_hi = _mm512_broadcast_i32x4(
+		_mm_loadu_si128((__m128i const *)(enc->col + 16)));
+
+	char *p = dst;
+	size_t i = 0;
+
+	for(; i + 64 <= len; i += 64) {
+		__m512i const x = _mm512_loadu_si512(src + i);
+		__m512i const d = _mm512_sub_epi8(
+			_mm512_or_si512(x, _mm512_set1_epi8(0x20)),
+			_mm512_set1_epi8('a'));
+
+		if(_mm512_cmpgt_epu8_mask(d, _mm512_set1_epi8('z' - 'a')) != 0) {
+			p += encode_scalar(enc, p, src + i, 64);
+			continue;
+		}
+
+		__mmask64 const first = _mm512_cmplt_epu8_mask(d,
+			_mm512_set1_epi8(16));
+		__m512i const row = _mm512_mask_blend_epi8(first,
+			_mm512_shuffle_epi8(row_hi, d), _mm512_shuffle_epi8(row_lo, d));
+		__m512i const col = _mm512_mask_blend_epi8(first,
+			_mm512_shuffle_epi8(col_hi, d), _mm512_shuffle_epi8(col_lo, d));
+
+		expand_ssse3(p, _mm512_extracti32x4_epi32(row, 0),
+					 _mm512_extracti32x4_epi32(col, 0));
+		expand_ssse3(p + 48, _mm512_extracti32x4_epi32(row, 1),
+					 _mm512_extracti32x4_epi32(col, 1));
+		expand_ssse3(p + 96, _mm512_extracti32x4_epi32(row, 2),
+					 _mm512_extracti32x4_epi32(col, 2));
+		expand_ssse3(p + 144, _mm512_extracti32x4_epi32(row, 3),
+					 _mm512_extracti32x4_epi32(col, 3));
+		p += 192;
+	}
+
+	return (size_t)(p - dst) + encode_scalar(enc, p, src + i, len - i);
+}
+#endif
+
+/* Kernel for the selected tier, encode_scalar is the reference */
+static encode_fn *encode_kernel(void)
+{
+	switch(cpu_tier()) {
+#ifdef CPU_X86
+		case tier_avx512:
+			return encode_avx512;
+		case tier_avx2:
+			return encode_avx2;
+		case tier_sse2:
+			if(cpu_has_ssse3())
+				return encode_ssse3;
+			return encode_scalar;
+#endif
+		default:
+			return encode_scalar;
+	}
+}
+
+/* Encode a whole file into one line of coordinates */
+static void encode_file(char const *const path,
+						struct polybius_enc const *const enc,
+						encode_fn *const encode)
+{
+	static char in[STREAM_BUFFER_SIZE];
+	static char out[3 * STREAM_BUFFER_SIZE + 1];
+
+	int const fd = stream_open(path);
+	uintmax_t skipped = 0;
+	size_t n;
+
+	while((n = read_full(fd, in, sizeof(in), path)) != 0) {
+		size_t const written = encode(enc, out, in, n);
+		skipped += n - written / 3;
+		write_all(STDOUT_FILENO, out, written);
+	}
+
+	write_all(STDOUT_FILENO, "\n", 1);
+	stream_close(fd, path);
+
+	if(skipped != 0) {
+		_warn("%s: %ju characters could not be mapped to "
+			  "coordinates, skipped", path, skipped);
+	}
+}
+
+static char decrypt_char(struct polybius const *const sq,
+						 char const *const string)
+{
+	size_t const a = (size_t)(string[0] - '1');
+	size_t const b = (size_t)(string[1] - '1');
+	return sq->cell[a * sq->size + b];
+}
+
+/* Bad coordinates are collected and reported once per input */
+#define DECODE_REPORT 8
+
+/* Decoder state carried across blocks of one input */
+struct polybius_dec {
+	struct polybius const *sq;
+
+	/* First digit of an incomplete pair, or -1 */
+	int pending;
+	uintmax_t pending_at;
+
+	/* Bytes consumed before the current block */
+	uintmax_t offset;
+
+	uintmax_t bad;
+	uintmax_t bad_at[DECODE_REPORT];
 };
 
-/* Assumes contiguous character encoding from a-z A-Z */
-static char const *encrypt_char(char const ch)
+static void polybius_dec(struct polybius_dec *const dec,
+						 struct polybius const *const sq)
 {
-	if(!(ch >= 'a' && ch <= 'z') && !(ch >= 'A' && ch <= 'Z'))
-		return NULL;
+	memset(dec, 0, sizeof(*dec));
+	dec->sq = sq;
+	dec->pending = -1;
+}
 
-	return square_map[tolower(ch) - 'a'];
+/* Space, '\t' to '\r' and ',' may appear anywhere between digits */
+static bool is_separator(unsigned char const ch)
+{
+	return ch == ' ' || ch == ',' || (ch >= '\t' && ch <= '\r');
 }
 
-static char decrypt_char(char const *const string)
+static void decode_bad(struct polybius_dec *const dec, uintmax_t const at)
 {
-	int const a = string[0] - '0';
-	int const b = string[1] - '0';
-	return square[a - 1][b - 1];
+	if(dec->bad < DECODE_REPORT)
+		dec->bad_at[dec->bad] = at;
+	++dec->bad;
+}
+
+/* Feed one byte at offset AT, returns the characters written to DST */
+static size_t decode_byte(struct polybius_dec *const dec, char *const dst,
+						  unsigned char const ch, uintmax_t const at)
+{
+	if(is_separator(ch))
+		return 0;
+
+	if(dec->pending < 0) {
+		dec->pending = ch;
+		dec->pending_at = at;
+		return 0;
+	}
+
+	size_t const a = (size_t)dec->pending - '1';
+	size_t const b = (size_t)ch - '1';
+	size_t const size = dec->sq->size;
+
+	dec->pending = -1;
+
+	if(a >= size || b >= size) {
+		decode_bad(dec, dec->pending_at);
+		return 0;
+	}
+
+	*dst = dec->sq->cell[a * size + b];
+	return 1;
+}
+
+/* Decode LEN bytes of SRC into DST, which needs room for LEN / 2 bytes.
+	Returns the characters written */
+typedef size_t decode_fn(struct polybius_dec *dec, char *dst,
+						 char const *src, size_t len);
+
+static size_t decode_scalar(struct polybius_dec *const dec, char *const dst,
+							char const *const src, size_t const len)
+{
+	char *p = dst;
+
+	for(size_t i = 0; i < len; ++i)
+		p += decode_byte(dec, p, (unsigned char)src[i], dec->offset + i);
+
+	dec->offset += len;
+	return (size_t)(p - dst);
+}
+
+#ifdef CPU_X86
+/* Shuffle masks gathering the row digits, column digits and separators
+	of 16 "RC " triples spread over 48 input bytes */
+static char const gather_row[3][16] = {
+	{0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+	{-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1},
+	{-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13}
+};
+
+static char const gather_col[3][16] = {
+	{1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+	{-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1},
+	{-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14}
+};
+
+static char const gather_sep[3][16] = {
+	{2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+	{-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1},
+	{-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15}
+};
+
+/* Look up 16 cell indices, all below 48 */
+__attribute__((target("ssse3")))
+static inline __m128i lookup_ssse3(struct polybius_dec const *const dec,
+								   __m128i const idx)
+{
+	char const *const cell = dec->sq->cell;
+	__m128i const first = _mm_cmplt_epi8(idx, _mm_set1_epi8(16));
+	__m128i const second = _mm_cmplt_epi8(idx, _mm_set1_epi8(32));
+	__m128i const lo = _mm_shuffle_epi8(
+		_mm_loadu_si128((__m128i const *)cell), idx);
+	__m128i const mid = _mm_shuffle_epi8(
+		_mm_loadu_si128((__m128i const *)(cell + 16)), idx);
+	__m128i const hi = _mm_shuffle_epi8(
+		_mm_loadu_si128((__m128i const *)(cell + 32)), idx);
+
+	return _mm_or_si128(_mm_and_si128(first, lo),
+		_mm_andnot_si128(first, _mm_or_si128(_mm_and_si128(second, mid),
+			_mm_andnot_si128(second, hi))));
+}
+
+/* Row and column digits both occupy 0 to size - 1 once '1' is removed */
+__attribute__((target("ssse3")))
+static inline __m128i in_square_ssse3(__m128i const d, __m128i const top)
+{
+	return _mm_cmpeq_epi8(_mm_min_epu8(d, top), d);
+}
+
+/* Decode 32 digits without separators, false unless all are in the
+	square */
+__attribute__((target("ssse3")))
+static inline bool packed_ssse3(struct polybius_dec const *const dec,
+								char *const dst, char const *const src)
+{
+	__m128i const d0 = _mm_sub_epi8(
+		_mm_loadu_si128((__m128i const *)src), _mm_set1_epi8('1'));
+	__m128i const d1 = _mm_sub_epi8(
+		_mm_loadu_si128((__m128i const *)(src + 16)), _mm_set1_epi8('1'));
+	__m128i const top = _mm_set1_epi8((char)(dec->sq->size - 1));
+	__m128i const ok = _mm_and_si128(in_square_ssse3(d0, top),
+									 in_square_ssse3(d1, top));
+
+	if(_mm_movemask_epi8(ok) != 0xffff)
+		return false;
+
+	/* size * row + col for each pair of bytes */
+	__m128i const weight = _mm_set1_epi16((short)(0x0100 | dec->sq->size));
+	__m128i const idx = _mm_packus_epi16(_mm_maddubs_epi16(d0, weight),
+										 _mm_maddubs_epi16(d1, weight));
+
+	_mm_storeu_si128((__m128i *)dst, lookup_ssse3(dec, idx));
+	return true;
+}
+
+/* Decode 16 "RC" pairs each followed by one separator, false unless
+	all digits are in the square and all separators are valid */
+__attribute__((target("ssse3")))
+static inline bool spaced_ssse3(struct polybius_dec const *const dec,
+								char *const dst, char const *const src)
+{
+	__m128i row = _mm_setzero_si128();
+	__m128i col = _mm_setzero_si128();
+	__m128i sep = _mm_setzero_si128();
+
+	for(size_t v = 0; v < 3; ++v) {
+		__m128i const x = _mm_loadu_si128((__m128i const *)(src + 16 * v));
+		row = _mm_or_si128(row, _mm_shuffle_epi8(x,
+			_mm_loadu_si128((__m128i const *)gather_row[v])));
+		col = _mm_or_si128(col, _mm_shuffle_epi8(x,
+			_mm_loadu_si128((__m128i const *)gather_col[v])));
+		sep = _mm_or_si128(sep, _mm_shuffle_epi8(x,
+			_mm_loadu_si128((__m128i const *)gather_sep[v])));
+	}
+
+	__m128i const top = _mm_set1_epi8((char)(dec->sq->size - 1));
+	__m128i const a = _mm_sub_epi8(row, _mm_set1_epi8('1'));
+	__m128i const b = _mm_sub_epi8(col, _mm_set1_epi8('1'));
+	__m128i const ws = _mm_sub_epi8(sep, _mm_set1_epi8('\t'));
+	__m128i const ok = _mm_and_si128(
+		_mm_and_si128(in_square_ssse3(a, top), in_square_ssse3(b, top)),
+		_mm_or_si128(in_square_ssse3(ws, _mm_set1_epi8('\r' - '\t')),
+			_mm_or_si128(_mm_cmpeq_epi8(sep, _mm_set1_epi8(' ')),
+						 _mm_cmpeq_epi8(sep, _mm_set1_epi8(',')))));
+
+	if(_mm_movemask_epi8(ok) != 0xffff)
+		return false;
+
+	/* Interleave back into pairs and fold as in packed_ssse3 */
+	__m128i const weight = _mm_set1_epi16((short)(0x0100 | dec->sq->size));
+	__m128i const idx = _mm_packus_epi16(
+		_mm_maddubs_epi16(_mm_unpacklo_epi8(a, b), weight),
+		_mm_maddubs_epi16(_mm_unpackhi_epi8(a, b), weight));
+
+	_mm_storeu_si128((__m128i *)dst, lookup_ssse3(dec, idx));
+	return true;
+}
+
+/* Whole runs of pairs take the vector paths whenever no digit is
+	pending, anything else goes through decode_byte */
+__attribute__((target("ssse3")))
+static size_t decode_ssse3(struct polybius_dec *const dec, char *const dst,
+						   char const *const src, size_t const len)
+{
+	char *p = dst;
+	size_t i = 0;
+
+	while(i < len) {
+		if(dec->pending < 0) {
+			if(i + 32 <= len && packed_ssse3(dec, p, src + i)) {
+				p += 16;
+				i += 32;
+				continue;
+			}
+			if(i + 48 <= len && spaced_ssse3(dec, p, src + i)) {
+				p += 16;
+				i += 48;
+				continue;
+			}
+		}
+
+		p += decode_byte(dec, p, (unsigned char)src[i], dec->offset + i);
+		++i;
+	}
+
+	dec->offset += len;
+	return (size_t)(p - dst);
+}
+
+/* Same as decode_ssse3, packed runs are decoded 64 digits at a time */
+__attribute__((target("avx2")))
+static size_t decode_avx2(struct polybius_dec *const dec, char *const dst,
+						  char const *const src, size_t const len)
+{
+	char const *const cell = dec->sq->cell;
+	__m256i const lo = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((__m128i const *)cell));
+	__m256i const mid = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((__m128i const *)(cell + 16)));
+	__m256i const hi = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((__m128i const *)(cell + 32)));
+	__m256i const one = _mm256_set1_epi8('1');
+	__m256i const top = _mm256_set1_epi8((char)(dec->sq->size - 1));
+	__m256i const weight = _mm256_set1_epi16(
+		(short)(0x0100 | dec->sq->size));
+
+	char *p = dst;
+	size_t i = 0;
+
+	while(i < len) {
+		if(dec->pending < 0) {
+			if(i + 64 <= len) {
+				__m256i const d0 = _mm256_sub_epi8(_mm256_loadu_si256(
+					(__m256i const *)(src + i)), one);
+				__m256i const d1 = _mm256_sub_epi8(_mm256_loadu_si256(
+					(__m256i const *)(src + i + 32)), one);
+				__m256i const ok = _mm256_and_si256(
+					_mm256_cmpeq_epi8(_mm256_min_epu8(d0, top), d0),
+					_mm256_cmpeq_epi8(_mm256_min_epu8(d1, top), d1));
+
+				if(_mm256_movemask_epi8(ok) == -1) {
+					/* packus interleaves the 128-bit lanes, restore them */
+					__m256i const idx = _mm256_permute4x64_epi64(
+						_mm256_packus_epi16(_mm256_maddubs_epi16(d0, weight),
+											_mm256_maddubs_epi16(d1, weight)),
+						0xd8);
+					__m256i const first = _mm256_cmpgt_epi8(
+						_mm256_set1_epi8(16), idx);
+					__m256i const second = _mm256_cmpgt_epi8(
+						_mm256_set1_epi8(32), idx);
+					__m256i const upper = _mm256_blendv_epi8(
+						_mm256_shuffle_epi8(hi, idx),
+						_mm256_shuffle_epi8(mid, idx), second);
+
+					_mm256_storeu_si256((__m256i *)p, _mm256_blendv_epi8(
+						upper, _mm256_shuffle_epi8(lo, idx), first));
+					p += 32;
+					i += 64;
+					continue;
+				}
+			}
+			if(i + 48 <= len && spaced_ssse3(dec, p, src + i)) {
+				p += 16;
+				i += 48;
+				continue;
+			}
+		}
+
+		p += decode_byte(dec, p, (unsigned char)src[i], dec->offset + i);
+		++i;
+	}
+
+	dec->offset += len;
+	return (size_t)(p - dst);
+}
+
+/* Same as decode_avx2, packed runs are decoded 128 digits at a time */
+__attribute__((target("avx512f,avx512bw")))
+static size_t decode_avx512(struct polybius_dec *const dec, char *const dst,
+							char const *const src, size_t const len)
+{
+	char const *const cell = dec->sq->cell;
+	__m512i const lo = _mm512_broadcast_i32x4(
+		_mm_loadu_si128((__m128i const *)cell));
+	__m512i const mid = _mm512_broadcast_i32x4(
+		_mm_loadu_si128((__m128i const *)(cell + 16)));
+	__m512i const hi = _mm512_broadcast_i32x4(
+		_mm_loadu_si128((__m128i const *)(cell + 32)));
+	__m512i const one = _mm512_set1_epi8('1');
+	__m512i const top = _mm512_set1_epi8((char)(dec->sq->size - 1));
+	__m512i const weight = _mm512_set1_epi16(
+		(short)(0x0100 | dec->sq->size));
+	__m512i const order = _mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7);
+
+	char *p = dst;
+	size_t i = 0;
+
+	while(i < len) {
+		if(dec->pending < 0) {
+			if(i + 128 <= len) {
+				__m512i const d0 = _mm512_sub_epi8(
+					_mm512_loadu_si512(src + i), one);
+				__m512i const d1 = _mm512_sub_epi8(
+					_mm512_loadu_si512(src + i + 64), one);
+
+				if((_mm512_cmpgt_epu8_mask(d0, top)
+					| _mm512_cmpgt_epu8_mask(d1, top)) == 0) {
+					__m512i const idx = _mm512_permutexvar_epi64(order,
+						_mm512_packus_epi16(_mm512_maddubs_epi16(d0, weight),
+											_mm512_maddubs_epi16(d1, weight)));
+					__mmask64 const first = _mm512_cmplt_epu8_mask(idx,
+						_mm512_set1_epi8(16));
+					__mmask64 const second = _mm512_cmplt_epu8_mask(idx,
+						_mm512_set1_epi8(32));
+					__m512i const upper = _mm512_mask_blend_epi8(second,
+						_mm512_shuffle_epi8(hi, idx),
+						_mm512_shuffle_epi8(mid, idx));
+
+					_mm512_storeu_si512(p, _mm512_mask_blend_epi8(first,
+						upper, _mm512_shuffle_epi8(lo, idx)));
+					p += 64;
+					i += 128;
+					continue;
+				}
+			}
+			if(i + 48 <= len && spaced_ssse3(dec, p, src + i)) {
+				p += 16;
+				i += 48;
+				continue;
+			}
+		}
+
+		p += decode_byte(dec, p, (unsigned char)src[i], dec->offset + i);
+		++i;
+	}
+
+	dec->offset += len;
+	return (size_t)(p - dst);
+}
+#endif
+
+/* Kernel for the selected tier, decode_scalar is the reference */
+static decode_fn *decode_kernel(void)
+{
+	switch(cpu_tier()) {
+#ifdef CPU_X86
+		case tier_avx512:
+			return decode_avx512;
+		case tier_avx2:
+			return decode_avx2;
+		case tier_sse2:
+			if(cpu_has_ssse3())
+				return decode_ssse3;
+			return decode_scalar;
+#endif
+		default:
+			return decode_scalar;
+	}
+}
+
+/* Decode a whole file of coordinates into one line of text */
+static void decode_file(char const *const path,
+						struct polybius const *const sq,
+						decode_fn *const decode)
+{
+	static char in[STREAM_BUFFER_SIZE];
+	static char out[STREAM_BUFFER_SIZE / 2 + 1];
+
+	struct polybius_dec dec;
+	polybius_dec(&dec, sq);
+
+	int const fd = stream_open(path);
+	size_t n;
+
+	while((n = read_full(fd, in, sizeof(in), path)) != 0)
+		write_all(STDOUT_FILENO, out, decode(&dec, out, in, n));
+
+	write_all(STDOUT_FILENO, "\n", 1);
+	stream_close(fd, path);
+
+	if(dec.pending >= 0)
+		decode_bad(&dec, dec.pending_at);
+
+	if(dec.bad != 0) {
+		char list[DECODE_REPORT * 24];
+		size_t const shown = dec.bad < DECODE_REPORT
+			? (size_t)dec.bad : DECODE_REPORT;
+		size_t off = 0;
+
+		for(size_t i = 0; i < shown; ++i) {
+			off += (size_t)snprintf(list + off, sizeof(list) - off,
+									"%s%ju", i ? ", " : "", dec.bad_at[i]);
+		}
+
+		_warn("%s: %ju invalid coordinates skipped, at byte %s%s", path,
+			  dec.bad, list, dec.bad > shown ? ", ..." : "");
+	}
 }
 
 static void polybius_square(char const *const string,
-							enum cipher_mode const cipher_mode)
+							enum cipher_mode const cipher_mode,
+							struct polybius const *const sq)
 {
+	struct polybius_enc const *const enc = &sq->enc;
+
 	if(cipher_mode == encrypt) {
 		for(size_t i = 0; string[i]; ++i) {
-			char const *const enc = encrypt_char(string[i]);
-			if(enc == NULL) {
+			unsigned char const ch = (unsigned char)string[i];
+			if(enc->len[ch] == 0) {
 				_warn("\ncharacter '%c' cound not be mapped to "
 					 "coordinates, skipping", string[i]);
 				continue;
 			}
-			printf("%s ", enc);
+			fwrite(enc->code[ch], 1, enc->len[ch], stdout);
 		}
 	} else {
 		if(strlen(string) != 2) {
 			_warn("\ncoordinates must be two digits long, skipping");
 			return;
-		} else if((string[0] - '0') < 1 || (string[0] - '0') > 5) {
+		} else if((string[0] - '0') < 1
+				  || (size_t)(string[0] - '0') > sq->size) {
 			_warn("\nfirst coordinate digit must "
-				 "be between 1 and 5, skipping");
+				 "be between 1 and %zu, skipping", sq->size);
 			return;
-		} else if((string[1] - '0') < 1 || (string[1] - '0') > 5) {
+		} else if((string[1] - '0') < 1
+				  || (size_t)(string[1] - '0') > sq->size) {
 			_warn("\nsecond coordinate digit must "
-				 "be between 1 and 5, skipping");
+				 "be between 1 and %zu, skipping", sq->size);
 			return;
 		}
 
-		putchar(decrypt_char(string));
+		putchar(decrypt_char(sq, string));
 	}
 }
 
 int main(int const argc, char *const *const argv)
 {
 	enum cipher_mode cipher_mode = none;
+	bool read_files = false;
+	bool alnum = false;
+	char const *key = "";
+	char merged = 'I';
 
 	quiet = false;
 
 	static char const *const default_strings_list[] = {NULL};
+	static char const *const default_files_list[] = {"-", NULL};
 	char const *const *strings_list;
 
 	int c;
 
-	while((c = getopt_long(argc, argv, "dehijq", long_opts, NULL)) != -1) {
+	while((c = getopt_long(argc, argv, "adefhiI:jk:q", long_opts, NULL)) != -1) {
 		switch(c) {
+			case 'a':
+				alnum = true;
+				break;
 			case 'd':
 				cipher_mode = decrypt;
 				break;
 			case 'e':
 				cipher_mode = encrypt;
 				break;
+			case 'f':
+				read_files = true;
+				break;
 			case 'h':
 				usage(EXIT_SUCCESS, argv[0]);
 				break;
 			case 'i':
-				square[2 - 1][4 - 1] = 'I';
+				merged = 'I';
+				break;
+			case 'I':
+				cpu_select(optarg);
 				break;
 			case 'j':
-				square[2 - 1][4 - 1] = 'J';
+				merged = 'J';
+				break;
+			case 'k':
+				key = optarg;
 				break;
 			case 'q':
 				quiet = true;
@@ -183,12 +944,37 @@ int main(int const argc, char *const *const argv)
 			 "defaulting to '--encrypt'");
 	}
 
+	for(char const *k = key; *k; ++k) {
+		if(!isalpha(*k) && !(alnum && isdigit(*k))) {
+			error(EXIT_FAILURE, 0, alnum ? "key must be alphanumeric"
+				  : "key must be alphabetic");
+		}
+	}
+
+	struct polybius sq;
+	polybius_build(&sq, key, alnum, merged);
+
+	if(read_files) {
+		strings_list = (optind < argc
+						? (char const *const *) &argv[optind]
+						: default_files_list);
+
+		for(size_t i = 0; strings_list[i]; ++i) {
+			if(cipher_mode == encrypt)
+				encode_file(strings_list[i], &sq.enc, encode_kernel());
+			else
+				decode_file(strings_list[i], &sq, decode_kernel());
+		}
+
+		return EXIT_SUCCESS;
+	}
+
 	strings_list = (optind < argc
 					? (char const *const *) &argv[optind]
 					: default_strings_list);
 
 	for(size_t i = 0; strings_list[i]; ++i) {
-		polybius_square(strings_list[i], cipher_mode);
+		polybius_square(strings_list[i], cipher_mode, &sq);
 		putchar('\n');
 	}
 
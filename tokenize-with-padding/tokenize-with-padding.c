@@ -8,9 +8,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../common/gather.h"
+#include "../common/stream.h"
 
 #define PROGRAM_NAME "tokenize-with-padding"
 
+/* Side of the square tiles the columnar transposition is blocked into */
+#define TILE_SIZE 64
+
+/* Bytes of transposed output held in memory at once */
+#define BAND_SIZE (1 << 26)
+
 #define _warn(...) do {					\
 		if(!quiet)						\
 			error(0, 0, __VA_ARGS__);	\
@@ -20,8 +31,12 @@
 static bool quiet;
 
 static struct option const long_opts[] = {
+	{"columnar", no_argument, NULL, 'c'},
 	{"delim", required_argument, NULL, 'd'},
+	{"files", no_argument, NULL, 'f'},
 	{"help", no_argument, NULL, 'h'},
+	{"inverse", no_argument, NULL, 'i'},
+	{"key", required_argument, NULL, 'k'},
 	{"padding", required_argument, NULL, 'p'},
 	{"quiet", no_argument, NULL, 'q'},
 
@@ -30,15 +45,26 @@ static struct option const long_opts[] = {
 
 static _Noreturn void usage(int const status, char const *const name)
 {
-	printf("Usage: %s [OPTION]... SIZE [STRING]...\n\n", name);
+	printf("Usage: %s [OPTION]... SIZE [STRING]...\n", name);
+	printf("  or:  %s [OPTION]... -f SIZE [FILE]...\n\n", name);
 	if(status != EXIT_SUCCESS) {
 		fprintf(stderr, "Try '%s --help' for more information.\n", name);
 	} else {
 		puts("Tokenize strings.");
 		printf("Example: %s 2 Hello World\n", name);
 		puts("\nOptions:\n\
+  -c, --columnar        read the padded SIZE-column matrix out\n\
+                        column by column (columnar transposition)\n\
   -d, --delim=STR       delimiting character\n\
+  -f, --files           tokenize the contents of FILEs instead of\n\
+                        STRINGs; with no FILE, or when FILE is -,\n\
+                        read standard input\n\
   -h, --help            display this help text and exit\n\
+  -i, --inverse         undo '--columnar': read SIZE equal columns\n\
+                        separated by the delimiter, as written by\n\
+                        '--columnar' with the same '--delim'\n\
+  -k, --key=KEY         with '--columnar', read columns in the\n\
+                        alphabetical order of KEY's SIZE characters\n\
   -p, --padding=CHAR    specify padding character\n\
   -q, --quiet           disable warnings");
 	}
@@ -46,49 +72,438 @@ static _Noreturn void usage(int const status, char const *const name)
 	exit(status);
 }
 
-/* Branchless saturating addition (overflow becomes UINTMAX_MAX) */
-static uintmax_t sat_add_uintmax_t(uintmax_t const x, uintmax_t const y)
+/* Running state, the inputs are tokenized as one concatenated stream */
+struct tokenizer {
+	uintmax_t token_size;
+	uintmax_t filled;
+	char const *delim;
+	size_t delim_len;
+	char padding;
+};
+
+/* Output entries alternate between input slices and the delimiter */
+static struct gather out = {.fd = STDOUT_FILENO};
+
+/* Queue whole runs of a token at once, a delimiter is only written once
+	more input arrives after a full token. BUF must stay valid until the
+	next gather_flush */
+static void tokenize_block(struct tokenizer *const t, char const *buf,
+						   size_t len)
+{
+	while(len != 0) {
+		if(t->filled == t->token_size) {
+			gather_add(&out, t->delim, t->delim_len);
+			t->filled = 0;
+		}
+
+		uintmax_t const room = t->token_size - t->filled;
+		size_t const n = (room < len) ? (size_t)room : len;
+
+		gather_add(&out, buf, n);
+		t->filled += n;
+		buf += n;
+		len -= n;
+	}
+}
+
+/* Pad only the final, partial token */
+static void tokenize_finish(struct tokenizer *const t)
+{
+	static char pad[STREAM_BUFFER_SIZE];
+
+	if(t->filled == 0 || t->filled == t->token_size)
+		return;
+
+	memset(pad, t->padding, sizeof(pad));
+
+	for(uintmax_t left = t->token_size - t->filled; left != 0;) {
+		size_t const n = (left < sizeof(pad)) ? (size_t)left : sizeof(pad);
+		gather_add(&out, pad, n);
+		left -= n;
+	}
+
+	t->filled = t->token_size;
+}
+
+/* Regular files are mapped so every slice can reference the input,
+	anything else is read block by block */
+static void tokenize_file(struct tokenizer *const t, char const *const path)
+{
+	static char buf[STREAM_BUFFER_SIZE];
+
+	int const fd = stream_open(path);
+	struct stat st;
+
+	if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0
+	   && lseek(fd, 0, SEEK_CUR) == 0) {
+		size_t const len = (size_t)st.st_size;
+		char *const map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if(map != MAP_FAILED) {
+			(void)madvise(map, len, MADV_SEQUENTIAL);
+			tokenize_block(t, map, len);
+			gather_flush(&out);
+			munmap(map, len);
+			stream_close(fd, path);
+			return;
+		}
+	}
+
+	size_t n;
+
+	while((n = read_full(fd, buf, sizeof(buf), path)) != 0) {
+		tokenize_block(t, buf, n);
+		gather_flush(&out);
+	}
+
+	stream_close(fd, path);
+}
+
+/* Whole input of the columnar modes */
+struct input {
+	char *buf;
+	size_t len;
+	size_t size;
+	bool mapped;
+};
+
+static void input_append(struct input *const in, char const *const buf,
+						 size_t const len)
+{
+	if(in->size - in->len < len) {
+		size_t size = in->size ? in->size : STREAM_BUFFER_SIZE;
+
+		while(size - in->len < len)
+			size *= 2;
+
+		char *const grown = realloc(in->buf, size);
+
+		if(grown == NULL)
+			error(EXIT_FAILURE, errno, "error allocating memory for input");
+
+		in->buf = grown;
+		in->size = size;
+	}
+
+	memcpy(in->buf + in->len, buf, len);
+	in->len += len;
+}
+
+/* A single regular file is mapped, anything else is read into memory */
+static void input_files(struct input *const in, char const *const *const paths)
+{
+	static char buf[STREAM_BUFFER_SIZE];
+
+	for(size_t i = 0; paths[i]; ++i) {
+		int const fd = stream_open(paths[i]);
+		struct stat st;
+
+		if(i == 0 && paths[1] == NULL && fstat(fd, &st) == 0
+		   && S_ISREG(st.st_mode) && st.st_size > 0
+		   && lseek(fd, 0, SEEK_CUR) == 0) {
+			in->len = (size_t)st.st_size;
+			in->buf = mmap(NULL, in->len, PROT_READ, MAP_PRIVATE, fd, 0);
+
+			if(in->buf != MAP_FAILED) {
+				in->mapped = true;
+				stream_close(fd, paths[i]);
+				return;
+			}
+
+			in->buf = NULL;
+			in->len = 0;
+		}
+
+		size_t n;
+
+		while((n = read_full(fd, buf, sizeof(buf), paths[i])) != 0)
+			input_append(in, buf, n);
+
+		stream_close(fd, paths[i]);
+	}
+}
+
+static void input_free(struct input *const in)
+{
+	if(in->mapped)
+		munmap(in->buf, in->len);
+	else
+		free(in->buf);
+}
+
+/* Input column of each output column: columns sorted by their key
+	character with a stable counting sort, or in order without a key */
+static size_t *key_order(char const *const key, size_t const cols)
+{
+	size_t *const order = malloc(cols * sizeof(*order));
+
+	if(order == NULL)
+		error(EXIT_FAILURE, errno, "error allocating memory for key");
+
+	if(key == NULL) {
+		for(size_t i = 0; i < cols; ++i)
+			order[i] = i;
+		return order;
+	}
+
+	size_t start[UCHAR_MAX + 1] = {0};
+
+	for(size_t i = 0; i < cols; ++i)
+		start[(unsigned char)key[i]]++;
+
+	for(size_t ch = 0, sum = 0; ch <= UCHAR_MAX; ++ch) {
+		size_t const count = start[ch];
+		start[ch] = sum;
+		sum += count;
+	}
+
+	for(size_t i = 0; i < cols; ++i)
+		order[start[(unsigned char)key[i]]++] = i;
+
+	return order;
+}
+
+/* Row-major matrix over the input, the last row may be short */
+struct matrix {
+	char const *buf;
+	size_t rows;
+	size_t cols;
+
+	/* Padded copy of a short last row, or NULL */
+	char *last;
+};
+
+static inline char const *matrix_row(struct matrix const *const m,
+									 size_t const r)
+{
+	if(m->last != NULL && r == m->rows - 1)
+		return m->last;
+
+	return m->buf + r * m->cols;
+}
+
+/* Emit the matrix column by column, each column one token. Output is
+	built in bands of whole columns, or of row slices of one column when a
+	column alone is taller than BAND_SIZE, and each band is filled tile by
+	tile so neither the row reads nor the column writes leave the cache */
+static void columnar(struct matrix const *const m, size_t const *const order,
+					 struct tokenizer *const t)
 {
-	uintmax_t res = x + y;
-	res |= -(res < x);
-	return res;
+	size_t const band_rows = (m->rows < BAND_SIZE) ? m->rows : BAND_SIZE;
+	size_t band_cols = BAND_SIZE / band_rows;
+
+	if(band_cols > m->cols)
+		band_cols = m->cols;
+
+	char *const band = malloc(band_cols * band_rows);
+
+	if(band == NULL)
+		error(EXIT_FAILURE, errno, "error allocating memory for columns");
+
+	for(size_t j0 = 0; j0 < m->cols; j0 += band_cols) {
+		size_t const j1 = (m->cols - j0 < band_cols) ? m->cols : j0 + band_cols;
+
+		for(size_t s0 = 0; s0 < m->rows; s0 += band_rows) {
+			size_t const s1 = (m->rows - s0 < band_rows) ? m->rows
+							  : s0 + band_rows;
+			size_t const height = s1 - s0;
+
+			for(size_t r0 = s0; r0 < s1; r0 += TILE_SIZE) {
+				size_t const r1 = (s1 - r0 < TILE_SIZE) ? s1 : r0 + TILE_SIZE;
+
+				for(size_t jt = j0; jt < j1; jt += TILE_SIZE) {
+					size_t const jt1 = (j1 - jt < TILE_SIZE) ? j1
+									   : jt + TILE_SIZE;
+
+					for(size_t r = r0; r < r1; ++r) {
+						char const *const row = matrix_row(m, r);
+						char *const dst = band + (r - s0);
+
+						for(size_t j = jt; j < jt1; ++j)
+							dst[(j - j0) * height] = row[order[j]];
+					}
+				}
+			}
+
+			tokenize_block(t, band, (j1 - j0) * height);
+			gather_flush(&out);
+		}
+	}
+
+	free(band);
 }
 
-static void tokenize_string(char const *const string,
-							uintmax_t const token_size,
-							char const *const delim)
+/* Undo columnar: column j of the output order is rows contiguous bytes
+	at buf + j * stride, and lands at position order[j] of each row. Rows are
+	rebuilt in bands, or in slices of one row when a row alone is wider
+	than BAND_SIZE, tile by tile */
+static void columnar_inverse(char const *const buf, size_t const rows,
+							 size_t const cols, size_t const stride,
+							 size_t const *const order,
+							 struct tokenizer *const t)
 {
-	uintmax_t count = token_size;
-	for(size_t i = 0; string[i]; ++i) {
-		if((uintmax_t)i == count) {
-			printf("%s", delim);
-			count += token_size;
+	size_t const band_width = (cols < BAND_SIZE) ? cols : BAND_SIZE;
+	size_t band_rows = BAND_SIZE / band_width;
+
+	if(band_rows > rows)
+		band_rows = rows;
+
+	/* Column read into each position of a row */
+	size_t *const column = malloc(cols * sizeof(*column));
+	char *const band = malloc(band_rows * band_width);
+
+	if(column == NULL || band == NULL)
+		error(EXIT_FAILURE, errno, "error allocating memory for rows");
+
+	for(size_t j = 0; j < cols; ++j)
+		column[order[j]] = j;
+
+	for(size_t r0 = 0; r0 < rows; r0 += band_rows) {
+		size_t const r1 = (rows - r0 < band_rows) ? rows : r0 + band_rows;
+
+		for(size_t p0 = 0; p0 < cols; p0 += band_width) {
+			size_t const p1 = (cols - p0 < band_width) ? cols
+							  : p0 + band_width;
+			size_t const width = p1 - p0;
+
+			for(size_t pt = p0; pt < p1; pt += TILE_SIZE) {
+				size_t const pt1 = (p1 - pt < TILE_SIZE) ? p1 : pt + TILE_SIZE;
+
+				for(size_t rt = r0; rt < r1; rt += TILE_SIZE) {
+					size_t const rt1 = (r1 - rt < TILE_SIZE) ? r1
+									   : rt + TILE_SIZE;
+
+					for(size_t p = pt; p < pt1; ++p) {
+						char const *const src = buf + column[p] * stride;
+						char *const dst = band + (p - p0);
+
+						for(size_t r = rt; r < rt1; ++r)
+							dst[(r - r0) * width] = src[r];
+					}
+				}
+			}
+
+			tokenize_block(t, band, (r1 - r0) * width);
+			gather_flush(&out);
 		}
+	}
+
+	free(column);
+	free(band);
+}
+
+/* Whether LEN bytes of BUF read as columnar output: COLS columns of equal
+	length, each but the last followed by the delimiter */
+static bool columnar_fits(char const *const buf, size_t const len,
+						  size_t const cols, struct tokenizer const *const t)
+{
+	size_t const delims = (cols - 1) * t->delim_len;
+
+	if(len < delims || (len - delims) % cols != 0)
+		return false;
+
+	size_t const rows = (len - delims) / cols;
 
-		putchar(string[i]);
+	for(size_t j = 0; j + 1 < cols; ++j) {
+		if(memcmp(buf + j * (rows + t->delim_len) + rows, t->delim,
+				  t->delim_len) != 0)
+			return false;
 	}
+
+	return true;
+}
+
+static void tokenize_columnar(struct input const *const in,
+							  size_t const cols, char const *const key,
+							  bool const inverse, struct tokenizer *const t)
+{
+	if(in->len == 0)
+		return;
+
+	size_t *const order = key_order(key, cols);
+
+	if(inverse) {
+		size_t len = in->len;
+
+		/* Drop the newline printed after columnar STRINGs */
+		if(in->buf[len - 1] == '\n' && columnar_fits(in->buf, len - 1, cols, t))
+			--len;
+
+		if(!columnar_fits(in->buf, len, cols, t))
+			error(EXIT_FAILURE, 0, "input must be SIZE equal columns "
+								   "separated by the delimiter with "
+								   "'--inverse'");
+
+		size_t const rows = (len - (cols - 1) * t->delim_len) / cols;
+
+		t->token_size = cols;
+		columnar_inverse(in->buf, rows, cols, rows + t->delim_len, order, t);
+		free(order);
+		return;
+	}
+
+	struct matrix m = {
+		.buf = in->buf,
+		.rows = in->len / cols + (in->len % cols != 0),
+		.cols = cols
+	};
+
+	if(in->len % cols != 0) {
+		size_t const used = in->len % cols;
+
+		if((m.last = malloc(cols)) == NULL)
+			error(EXIT_FAILURE, errno, "error allocating memory for padding");
+
+		memcpy(m.last, in->buf + in->len - used, used);
+		memset(m.last + used, t->padding, cols - used);
+	}
+
+	t->token_size = m.rows;
+	columnar(&m, order, t);
+
+	free(m.last);
+	free(order);
 }
 
 int main(int const argc, char *const *const argv)
 {
 	quiet = false;
+	bool read_files = false;
+	bool columnar_mode = false;
+	bool inverse = false;
 
+	char const *key = NULL;
 	char const *delim = " ";
 	char const *padding = " ";
 
 	static char const *const default_strings_list[] = {NULL};
+	static char const *const default_files_list[] = {"-", NULL};
 	char const *const *strings_list;
 
 	int c;
 
-	while((c = getopt_long(argc, argv, "d:hp:q", long_opts, NULL)) != -1) {
+	while((c = getopt_long(argc, argv, "cd:fhik:p:q", long_opts, NULL)) != -1) {
 		switch(c) {
+			case 'c':
+				columnar_mode = true;
+				break;
 			case 'd':
 				delim = optarg;
 				break;
+			case 'f':
+				read_files = true;
+				break;
 			case 'h':
 				usage(EXIT_SUCCESS, argv[0]);
 				break;
+			case 'i':
+				columnar_mode = true;
+				inverse = true;
+				break;
+			case 'k':
+				columnar_mode = true;
+				key = optarg;
+				break;
 			case 'p':
 				padding = optarg;
 				break;
@@ -112,41 +527,70 @@ int main(int const argc, char *const *const argv)
 	else if(token_size == 0)
 		error(EXIT_FAILURE, 0, "token size must be greater than zero");
 
-	if(strlen(padding) > 1)
+	if(padding[0] == '\0')
+		error(EXIT_FAILURE, 0, "padding must be a character");
+	else if(strlen(padding) > 1)
 		_warn("padding only uses the first character specified");
 
-	strings_list = (optind < argc
-					? (char const *const *) &argv[optind]
-					: default_strings_list);
-
-	uintmax_t fstring_len = 0;
+	if(key != NULL && strlen(key) != token_size)
+		error(EXIT_FAILURE, 0, "key must be SIZE characters long");
+
+	if(columnar_mode && token_size > SIZE_MAX)
+		error(EXIT_FAILURE, 0, "token size is too large for '--columnar'");
+
+	struct tokenizer tokenizer = {
+		.token_size = token_size,
+		.delim = delim,
+		.delim_len = strlen(delim),
+		.padding = padding[0]
+	};
+
+	if(columnar_mode) {
+		struct input in = {0};
+
+		if(read_files) {
+			input_files(&in, (optind < argc
+							  ? (char const *const *) &argv[optind]
+							  : default_files_list));
+		} else {
+			for(int i = optind; i < argc; ++i)
+				input_append(&in, argv[i], strlen(argv[i]));
+		}
 
-	for(size_t i = 0; strings_list[i]; ++i)
-		fstring_len = sat_add_uintmax_t(fstring_len, strlen(strings_list[i]));
+		tokenize_columnar(&in, (size_t)token_size, key, inverse, &tokenizer);
+		input_free(&in);
 
-	while(fstring_len % token_size != 0)
-		fstring_len++;
+		if(!read_files)
+			gather_add(&out, "\n", 1);
+		gather_flush(&out);
 
-	char *fstring = malloc(fstring_len + 1);
+		return EXIT_SUCCESS;
+	}
 
-	if(fstring == NULL)
-		error(EXIT_FAILURE, 0, "error allocating memory for string.\n");
+	if(read_files) {
+		strings_list = (optind < argc
+						? (char const *const *) &argv[optind]
+						: default_files_list);
 
-	if(strings_list[0] != NULL)
-		strcpy(fstring, strings_list[0]);
+		for(size_t i = 0; strings_list[i]; ++i)
+			tokenize_file(&tokenizer, strings_list[i]);
 
-	for(size_t i = 1; strings_list[i]; ++i)
-		strcat(fstring, strings_list[i]);
+		tokenize_finish(&tokenizer);
+		gather_flush(&out);
 
-	/* Padding */
-	while(strlen(fstring) % token_size != 0)
-		strncat(fstring, padding, 1);
+		return EXIT_SUCCESS;
+	}
 
-	tokenize_string(fstring, token_size, delim);
+	strings_list = (optind < argc
+					? (char const *const *) &argv[optind]
+					: default_strings_list);
 
-	free(fstring);
+	for(size_t i = 0; strings_list[i]; ++i)
+		tokenize_block(&tokenizer, strings_list[i], strlen(strings_list[i]));
 
-	putchar('\n');
+	tokenize_finish(&tokenizer);
+	gather_add(&out, "\n", 1);
+	gather_flush(&out);
 
 	return EXIT_SUCCESS;
 }